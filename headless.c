@@ -0,0 +1,415 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "simulation.h"
+
+// Headless batch runner: drives the simulation core without a window and as
+// fast as the CPU allows, then prints a summary of the run.
+//
+// Arrivals are timed events on a priority queue. The controller decides
+// when a lane queue change asks for it or its rotation slot runs out, as the
+// controller thread of the windowed simulator does. The tick engine moves
+// vehicles every step (SIM_TICK_MS unless --step says otherwise); the event
+// engine only ticks while some vehicle on screen is moving and otherwise
+// jumps the clock straight to the next arrival or controller deadline. The
+// mesoscopic engine has no positions at all, only lane queues that fill
+// after a travel delay and drain at a fixed rate while green, and jumps from
+// one event to the next.
+
+typedef enum {
+    ENGINE_TICK,
+    ENGINE_EVENT,
+    ENGINE_MESO
+} EngineMode;
+
+typedef enum {
+    EVENT_SPAWN,   // random arrival, as generateVehicles()
+    EVENT_FILE     // vehicle data file feed, as readAndParseFile()
+} HeadlessEventType;
+
+typedef struct {
+    double duration;       // simulated seconds to run
+    double timeScale;      // 0 = as fast as possible
+    double step;           // simulated seconds per vehicle update
+    EngineMode engine;
+    double headway;        // mesoscopic discharge headway, 0 for the controller's estimate
+    double spawnInterval;  // simulated seconds between random arrivals
+    unsigned int seed;
+    const char* tracePath;   // write the world hash of every tick here
+    const char* comparePath; // check every tick against this trace
+    const char* vehicleFile; // optional vehicle data file, re-read every second
+    int capacity;          // initial vehicle pool size; the pool grows past it
+    int threads;           // threads stepping the vehicles
+    bool verbose;
+} HeadlessOptions;
+
+typedef struct {
+    long ticks;         // vehicle updates, or events handled by the mesoscopic engine
+    double idleSkipped; // simulated seconds jumped over by the event engine
+    long controllerSteps;
+    int maxQueue[NUM_LANES];
+} RunStats;
+
+// Trace of a run: a header, then one record per tick holding the simulated
+// time and the rolling hash of the world state after that tick
+#define TRACE_MAGIC "TSTRACE1"
+
+typedef struct {
+    char magic[8];
+    uint64_t seed;
+} TraceHeader;
+
+typedef struct {
+    double time;
+    uint64_t hash;
+} TraceRecord;
+
+typedef struct {
+    FILE* output;
+    FILE* expected;
+    uint64_t hash;
+    long divergedAt; // first tick that did not match the expected trace, -1 if none
+    double divergedTime;
+    bool endedEarly; // the expected trace goes on past the end of this run
+} TraceState;
+
+static bool openTrace(const HeadlessOptions* options, TraceState* trace) {
+    trace->output = NULL;
+    trace->expected = NULL;
+    trace->hash = WORLD_HASH_SEED;
+    trace->divergedAt = -1;
+    trace->endedEarly = false;
+
+    if (options->tracePath) {
+        trace->output = fopen(options->tracePath, "wb");
+        if (!trace->output) {
+            perror("Error opening trace");
+            return false;
+        }
+        TraceHeader header = { TRACE_MAGIC, options->seed };
+        fwrite(&header, sizeof(header), 1, trace->output);
+    }
+    if (options->comparePath) {
+        trace->expected = fopen(options->comparePath, "rb");
+        if (!trace->expected) {
+            perror("Error opening trace to compare");
+            return false;
+        }
+        TraceHeader header;
+        if (fread(&header, sizeof(header), 1, trace->expected) != 1 ||
+            memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+            fprintf(stderr, "%s is not a trace file\n", options->comparePath);
+            return false;
+        }
+        if (header.seed != options->seed) {
+            fprintf(stderr, "Trace was recorded with seed %llu, this run uses %u; they can never match\n",
+                    (unsigned long long)header.seed, options->seed);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hash the world after a tick, then write and/or check the record
+static void recordTick(TraceState* trace, long tick, double time) {
+    if (!trace->output && !trace->expected) return;
+
+    trace->hash = hashWorldState(trace->hash);
+    TraceRecord record = { time, trace->hash };
+    if (trace->output) {
+        fwrite(&record, sizeof(record), 1, trace->output);
+    }
+    if (trace->expected && trace->divergedAt == -1) {
+        TraceRecord expected;
+        if (fread(&expected, sizeof(expected), 1, trace->expected) != 1 ||
+            expected.time != record.time || expected.hash != record.hash) {
+            trace->divergedAt = tick;
+            trace->divergedTime = time;
+        }
+    }
+}
+
+// A run that matched so far but stops before the expected trace does
+// diverges at its first missing tick
+static void closeTrace(TraceState* trace, long ticks) {
+    if (trace->output) fclose(trace->output);
+    if (trace->expected) {
+        TraceRecord expected;
+        if (trace->divergedAt == -1 && fread(&expected, sizeof(expected), 1, trace->expected) == 1) {
+            trace->divergedAt = ticks;
+            trace->divergedTime = expected.time;
+            trace->endedEarly = true;
+        }
+        fclose(trace->expected);
+    }
+}
+
+static void printUsage(const char* program) {
+    printf("Usage: %s [--duration SECONDS] [--time-scale X] [--step SECONDS] [--engine tick|event|meso] [--headway SECONDS] [--spawn-interval SECONDS] [--seed N] [--trace PATH] [--compare PATH] [--file PATH] [--capacity N] [--threads N] [--verbose]\n", program);
+}
+
+static bool parseOptions(int argc, char* argv[], HeadlessOptions* options) {
+    options->duration = 3600;
+    options->timeScale = 0;
+    options->step = SIM_TICK_SECONDS;
+    options->engine = ENGINE_TICK;
+    options->headway = 0;
+    options->spawnInterval = VEHICLE_SPAWN_INTERVAL_MS / 1000.0;
+    options->seed = (unsigned int)time(NULL);
+    options->tracePath = NULL;
+    options->comparePath = NULL;
+    options->vehicleFile = NULL;
+    options->capacity = INITIAL_VEHICLE_CAPACITY;
+    options->threads = 1;
+    options->verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            options->duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc) {
+            options->timeScale = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc) {
+            options->step = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "tick") == 0) {
+                options->engine = ENGINE_TICK;
+            } else if (strcmp(argv[i], "event") == 0) {
+                options->engine = ENGINE_EVENT;
+            } else if (strcmp(argv[i], "meso") == 0) {
+                options->engine = ENGINE_MESO;
+            } else {
+                printUsage(argv[0]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--headway") == 0 && i + 1 < argc) {
+            options->headway = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--spawn-interval") == 0 && i + 1 < argc) {
+            options->spawnInterval = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options->seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options->tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            options->comparePath = argv[++i];
+        } else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+            options->vehicleFile = argv[++i];
+        } else if (strcmp(argv[i], "--capacity") == 0 && i + 1 < argc) {
+            options->capacity = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options->threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--verbose") == 0 || strcmp(argv[i], "-v") == 0) {
+            options->verbose = true;
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    return options->duration > 0 && options->timeScale >= 0 && options->step > 0 &&
+           options->spawnInterval > 0 && options->headway >= 0 &&
+           options->capacity > 0 && options->threads > 0;
+}
+
+// Handle one event and schedule its successor; returns false on a fatal error
+static bool handleEvent(const SimEvent* event, EventQueue* events, const HeadlessOptions* options) {
+    switch (event->type) {
+        case EVENT_SPAWN:
+            spawnRandomVehicle();
+            scheduleEvent(events, event->time + options->spawnInterval, EVENT_SPAWN, 0);
+            break;
+
+        case EVENT_FILE:
+            if (spawnVehiclesFromFile(options->vehicleFile, options->verbose) < 0) {
+                perror("Error opening file");
+                return false;
+            }
+            scheduleEvent(events, event->time + 1, EVENT_FILE, 0);
+            break;
+    }
+    return true;
+}
+
+static void trackMaxQueues(RunStats* stats) {
+    for (int i = 0; i < NUM_LANES; i++) {
+        if (laneQueueLength(i) > stats->maxQueue[i]) {
+            stats->maxQueue[i] = laneQueueLength(i);
+        }
+    }
+}
+
+static bool runEngine(const HeadlessOptions* options, TrafficController* ctrl, RunStats* stats,
+                      TraceState* trace) {
+    EventQueue events;
+    initEventQueue(&events);
+    scheduleEvent(&events, 0, EVENT_SPAWN, 0);
+    if (options->vehicleFile) {
+        scheduleEvent(&events, 0, EVENT_FILE, 0);
+    }
+
+    double nextDecision = 0; // controller deadline
+    bool idle = false;
+    // Stop at the last whole step; summing steps leaves rounding error
+    double end = options->duration - options->step * 1e-6;
+    while (simClock.now < end) {
+        double now = simClock.now;
+
+        // Nothing moves until the next event, so skip straight to it
+        if (idle) {
+            double next = fmin(nextEventTime(&events), nextDecision);
+            if (next > options->duration) {
+                next = options->duration;
+            }
+            if (next > now) {
+                stats->idleSkipped += next - now;
+                simClockAdvance(&simClock, next - now);
+                simClockPace(&simClock);
+                continue;
+            }
+        }
+
+        SimEvent event;
+        while (nextEventTime(&events) <= now && popEvent(&events, &event)) {
+            if (!handleEvent(&event, &events, options)) {
+                freeEventQueue(&events);
+                return false;
+            }
+        }
+
+        drainSpawnRequests(); // random arrivals queued by the spawn events above
+        int moved = updateVehicles(options->step);
+        idle = options->engine == ENGINE_EVENT && moved == 0;
+
+        if (takeControllerWake() || now >= nextDecision) {
+            nextDecision = trafficControllerStep(ctrl, now);
+            stats->controllerSteps++;
+            idle = false; // the lights may have let someone go
+        }
+
+        trackMaxQueues(stats);
+        recordTick(trace, stats->ticks, now);
+
+        simClockAdvance(&simClock, options->step);
+        simClockPace(&simClock);
+        stats->ticks++;
+    }
+
+    freeEventQueue(&events);
+    return true;
+}
+
+// Mesoscopic engine: same arrivals and controller, but the clock jumps from
+// event to event and nothing is moved
+static bool runMesoscopic(const HeadlessOptions* options, TrafficController* ctrl, RunStats* stats,
+                          TraceState* trace) {
+    EventQueue events;
+    initEventQueue(&events);
+    scheduleEvent(&events, 0, EVENT_SPAWN, 0);
+    if (options->vehicleFile) {
+        scheduleEvent(&events, 0, EVENT_FILE, 0);
+    }
+
+    double nextDecision = 0;
+    while (simClock.now < options->duration) {
+        double now = simClock.now;
+
+        SimEvent event;
+        while (nextEventTime(&events) <= now && popEvent(&events, &event)) {
+            if (!handleEvent(&event, &events, options)) {
+                freeEventQueue(&events);
+                return false;
+            }
+        }
+        drainSpawnRequests(); // random arrivals queued by the spawn events above
+        mesoAdvance(now);
+        if (takeControllerWake() || now >= nextDecision) {
+            nextDecision = trafficControllerStep(ctrl, now);
+            stats->controllerSteps++;
+            mesoAdvance(now); // a lane that just turned green starts to drain
+        }
+        trackMaxQueues(stats);
+        recordTick(trace, stats->ticks, now);
+        stats->ticks++;
+
+        double next = fmin(fmin(nextEventTime(&events), mesoNextEventTime()), nextDecision);
+        if (next > options->duration) {
+            next = options->duration;
+        }
+        if (next <= now) {
+            next = nextafter(now, INFINITY); // always make progress
+        }
+        simClockAdvance(&simClock, next - now);
+        simClockPace(&simClock);
+    }
+
+    freeEventQueue(&events);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    HeadlessOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        return 1;
+    }
+
+    seedSimulation(options.seed);
+    initVehicles(options.capacity);
+    initVehicleWorkers(options.threads);
+    if (options.engine == ENGINE_MESO) {
+        initMesoscopic(options.headway);
+    }
+    initTrafficLights();
+    simClockInit(&simClock, options.timeScale);
+
+    TrafficController ctrl;
+    initTrafficController(&ctrl, 0);
+    ctrl.verbose = options.verbose;
+
+    TraceState trace;
+    if (!openTrace(&options, &trace)) {
+        return 1;
+    }
+
+    RunStats stats = {0};
+    double start = wallClockSeconds();
+    bool ok = options.engine == ENGINE_MESO ? runMesoscopic(&options, &ctrl, &stats, &trace)
+                                            : runEngine(&options, &ctrl, &stats, &trace);
+    if (!ok) {
+        return 1;
+    }
+    double wallSeconds = wallClockSeconds() - start;
+    closeTrace(&trace, stats.ticks);
+
+    const char* engineNames[] = { "tick", "event", "meso" };
+    const char* stepName = options.engine == ENGINE_MESO ? "events" : "ticks";
+    printf("Engine:           %s\n", engineNames[options.engine]);
+    printf("Simulated time:   %.1f s (%ld %s, %.1f s idle skipped)\n",
+           simClock.now, stats.ticks, stepName, stats.idleSkipped);
+    printf("Wall time:        %.3f s (%.0f %s/s)\n", wallSeconds,
+           wallSeconds > 0 ? stats.ticks / wallSeconds : 0.0, stepName);
+    printf("Seed:             %u\n", options.seed);
+    printf("Vehicles spawned: %ld\n", simStats.vehiclesSpawned);
+    printf("Vehicles dropped: %ld\n", simStats.vehiclesDropped);
+    printf("Vehicles retired: %ld\n", simStats.vehiclesRetired);
+    printf("Vehicles active:  %d (peak %d, pool capacity %d)\n",
+           simStats.activeVehicles, simStats.peakActiveVehicles, vehicles.capacity);
+    printf("Phase changes:    %d (%ld controller decisions)\n", ctrl.phaseChanges, stats.controllerSteps);
+    printf("Final queues:     A2:%d, B2:%d, C2:%d, D2:%d\n",
+           laneQueues[0].size, laneQueues[1].size, laneQueues[2].size, laneQueues[3].size);
+    printf("Max queues:       A2:%d, B2:%d, C2:%d, D2:%d\n",
+           stats.maxQueue[0], stats.maxQueue[1], stats.maxQueue[2], stats.maxQueue[3]);
+    if (options.tracePath || options.comparePath) {
+        printf("World hash:       %016llx\n", (unsigned long long)trace.hash);
+    }
+    if (options.comparePath) {
+        if (trace.divergedAt != -1) {
+            printf("Compare:          diverged at tick %ld (%.3f s)%s\n", trace.divergedAt, trace.divergedTime,
+                   trace.endedEarly ? ", where the expected trace continues past the end of this run" : "");
+            return 2;
+        }
+        printf("Compare:          all %ld %s match\n", stats.ticks, stepName);
+    }
+    return 0;
+}
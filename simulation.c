@@ -0,0 +1,1958 @@
+#include "simulation.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+VehiclePool vehicles;
+static _Atomic LightPhase lightPhase;
+TrafficQueue laneQueues[NUM_LANES];
+pthread_mutex_t vehicleMutex = PTHREAD_MUTEX_INITIALIZER;
+SimStats simStats;
+
+// Free vehicle slots, used as a stack so spawn and retire are O(1);
+// sized to the pool capacity
+static int* freeSlots;
+static int freeSlotCount;
+
+// Random streams: arrivals are drawn by whichever thread generates them,
+// vehicle attributes under vehicleMutex, so each stream has one user at a time
+static SimRandom spawnRandom = { 1 };
+static SimRandom vehicleRandom = { 2 };
+
+// Vehicles of each lane and sublane, ordered front to back
+LaneList laneLists[NUM_LANES][3];
+
+// Counters mirroring the lane lists and queues, so they can be read in O(1)
+// without vehicleMutex. They are written under the mutex, or by the worker
+// stepping that lane's list, and are always exact between two ticks.
+static atomic_int occupancyCount[NUM_LANES][3];
+static atomic_int waitingCount[NUM_LANES][3]; // of those, slower than IDM_STOP_SPEED
+static atomic_int queueLength[NUM_LANES];
+SimClock simClock = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0.0, 1.0 };
+
+// Triple buffer of world snapshots. The publisher fills the slot it owns
+// and swaps it into sharedSnapshot; the reader swaps its own slot for the
+// shared one when that holds something new. Each side only ever writes a
+// slot it owns, so no lock is needed.
+#define SNAPSHOT_FRESH 4 // set in sharedSnapshot until the reader takes it
+static WorldSnapshot snapshots[3];
+static int publishSlot = 0;
+static atomic_int sharedSnapshot = 1;
+static int readSlot = 2;
+static long snapshotTick;
+
+// splitmix64: tiny, fast, and the same sequence on every platform
+unsigned int simRandomNext(SimRandom* rng) {
+    uint64_t z = (rng->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (unsigned int)((z ^ (z >> 31)) >> 32);
+}
+
+// Seed every random stream of the simulation from one number
+void seedSimulation(uint64_t seed) {
+    spawnRandom.state = seed;
+    vehicleRandom.state = seed ^ 0xD1B54A32D192ED03ULL;
+}
+
+// FNV-1a over 64-bit words rather than bytes, which is plenty to tell two
+// world states apart and much cheaper on large pools
+#define FNV_PRIME 0x100000001B3ULL
+static inline uint64_t hashWord(uint64_t hash, uint64_t word) {
+    return (hash ^ word) * FNV_PRIME;
+}
+
+static inline uint32_t floatBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Fold the whole world state into a running hash: every active vehicle in
+// slot order, the lane queues front to back and the lights. Positions and
+// speeds are hashed bit for bit, so any numerical drift shows up.
+uint64_t hashWorldState(uint64_t hash) {
+    pthread_mutex_lock(&vehicleMutex);
+    for (int i = 0; i < vehicles.capacity; i++) {
+        if (!vehicles.active[i]) continue;
+        hash = hashWord(hash, (uint64_t)i);
+        hash = hashWord(hash, (uint64_t)floatBits(vehicles.x[i]) << 32 | floatBits(vehicles.y[i]));
+        hash = hashWord(hash, (uint64_t)floatBits(vehicles.speed[i]) << 32 | floatBits(vehicles.routeDistance[i]));
+        hash = hashWord(hash, (uint64_t)(unsigned char)vehicles.lane[i] << 24 |
+                              (uint64_t)vehicles.sublane[i] << 16 |
+                              (uint64_t)vehicles.route[i] << 8 |
+                              (unsigned char)vehicles.queuedLane[i]);
+        hash = hashWord(hash, (uint64_t)(uint32_t)vehicles.laneAhead[i] << 32 | (uint32_t)vehicles.laneBehind[i]);
+        hash = hashWord(hash, (uint64_t)(uint32_t)vehicles.info[i].direction << 32 | (uint32_t)vehicles.junctionOrder[i]);
+    }
+    LightPhase lights = readLightPhase();
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        TrafficQueue* queue = &laneQueues[lane];
+        hash = hashWord(hash, (uint64_t)queue->size);
+        for (int n = 0; n < queue->size; n++) {
+            hash = hashWord(hash, (uint64_t)queue->vehicleIndices[(queue->front + n) % queue->capacity]);
+        }
+        hash = hashWord(hash, LIGHT_GREEN(lights, lane));
+    }
+    pthread_mutex_unlock(&vehicleMutex);
+    return hash;
+}
+
+double wallClockSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void simClockInit(SimClock* clock, double timeScale) {
+    pthread_mutex_lock(&clock->lock);
+    clock->now = 0.0;
+    clock->timeScale = timeScale;
+    clock->participantCount = 0;
+    clock->paceStart = wallClockSeconds();
+    pthread_mutex_unlock(&clock->lock);
+}
+
+double simClockNow(SimClock* clock) {
+    pthread_mutex_lock(&clock->lock);
+    double now = clock->now;
+    pthread_mutex_unlock(&clock->lock);
+    return now;
+}
+
+// Register the calling thread; the clock will not advance until it first sleeps
+int simClockRegister(SimClock* clock) {
+    pthread_mutex_lock(&clock->lock);
+    int participant = clock->participantCount;
+    if (participant < SIM_CLOCK_MAX_PARTICIPANTS) {
+        clock->wakeAt[participant] = clock->now;
+        clock->sleeping[participant] = false;
+        clock->notified[participant] = false;
+        clock->participantCount++;
+    } else {
+        participant = -1;
+    }
+    pthread_mutex_unlock(&clock->lock);
+    return participant;
+}
+
+// Block until the simulated clock has moved forward by the given amount, or
+// until simClockNotify() wakes the participant; returns true in that case.
+// seconds may be INFINITY to wait for a notification only.
+bool simClockSleep(SimClock* clock, int participant, double seconds) {
+    pthread_mutex_lock(&clock->lock);
+    double wakeAt = clock->now + seconds;
+    bool notified = false;
+    if (participant >= 0) {
+        clock->wakeAt[participant] = wakeAt;
+        clock->sleeping[participant] = true;
+        pthread_cond_broadcast(&clock->changed);
+    }
+    while (clock->now < wakeAt) {
+        if (participant >= 0 && clock->notified[participant]) {
+            notified = true;
+            break;
+        }
+        pthread_cond_wait(&clock->changed, &clock->lock);
+    }
+    if (participant >= 0) {
+        clock->sleeping[participant] = false;
+        clock->notified[participant] = false;
+    }
+    pthread_mutex_unlock(&clock->lock);
+    return notified;
+}
+
+// Wake a participant at the current instant. A notification sent while it is
+// awake is kept, so its next sleep returns straight away.
+void simClockNotify(SimClock* clock, int participant) {
+    pthread_mutex_lock(&clock->lock);
+    clock->notified[participant] = true;
+    pthread_cond_broadcast(&clock->changed);
+    pthread_mutex_unlock(&clock->lock);
+}
+
+// Move simulated time forward, stopping at every participant deadline on the way
+void simClockAdvance(SimClock* clock, double seconds) {
+    pthread_mutex_lock(&clock->lock);
+    double target = clock->now + seconds;
+    while (1) {
+        bool busy = false;
+        double earliest = target + 1.0;
+        for (int i = 0; i < clock->participantCount; i++) {
+            if (!clock->sleeping[i] || clock->wakeAt[i] <= clock->now || clock->notified[i]) {
+                busy = true; // still working on the current instant
+            } else if (clock->wakeAt[i] < earliest) {
+                earliest = clock->wakeAt[i];
+            }
+        }
+        if (busy) {
+            pthread_cond_wait(&clock->changed, &clock->lock);
+            continue;
+        }
+        if (earliest > target) {
+            clock->now = target;
+            break;
+        }
+        clock->now = earliest;
+        pthread_cond_broadcast(&clock->changed);
+    }
+    pthread_mutex_unlock(&clock->lock);
+}
+
+// Sleep the caller so simulated time does not run ahead of wall time * timeScale.
+// After a stall the clock catches up by at most SIM_CLOCK_MAX_LAG wall seconds;
+// the rest is written off by moving the pacing start forward.
+void simClockPace(SimClock* clock) {
+    if (clock->timeScale <= 0) return; // unlimited
+    pthread_mutex_lock(&clock->lock);
+    double ahead = clock->now / clock->timeScale - (wallClockSeconds() - clock->paceStart);
+    if (ahead < -SIM_CLOCK_MAX_LAG) {
+        clock->paceStart += -ahead - SIM_CLOCK_MAX_LAG;
+    }
+    pthread_mutex_unlock(&clock->lock);
+    if (ahead > 0) {
+        usleep((useconds_t)(ahead * 1e6));
+    }
+}
+
+// Simulated time that pacing is aiming for at this wall clock instant; moves
+// continuously, unlike the clock itself. Equal to the clock when unpaced.
+double simClockPacedTime(SimClock* clock) {
+    pthread_mutex_lock(&clock->lock);
+    double time = clock->now;
+    if (clock->timeScale > 0) {
+        time = (wallClockSeconds() - clock->paceStart) * clock->timeScale;
+    }
+    pthread_mutex_unlock(&clock->lock);
+    return time;
+}
+
+// Event queue: binary min-heap ordered by time, then by scheduling order
+void initEventQueue(EventQueue* queue) {
+    queue->events = NULL;
+    queue->size = 0;
+    queue->capacity = 0;
+    queue->nextSequence = 0;
+}
+
+void freeEventQueue(EventQueue* queue) {
+    free(queue->events);
+    initEventQueue(queue);
+}
+
+static bool eventBefore(const SimEvent* a, const SimEvent* b) {
+    return a->time < b->time || (a->time == b->time && a->sequence < b->sequence);
+}
+
+void scheduleEvent(EventQueue* queue, double time, int type, int data) {
+    if (queue->size == queue->capacity) {
+        int capacity = queue->capacity ? queue->capacity * 2 : 64;
+        SimEvent* events = realloc(queue->events, capacity * sizeof(SimEvent));
+        if (!events) {
+            perror("Error growing event queue");
+            exit(1);
+        }
+        queue->events = events;
+        queue->capacity = capacity;
+    }
+
+    SimEvent event = { time, queue->nextSequence++, type, data };
+    int i = queue->size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!eventBefore(&event, &queue->events[parent])) break;
+        queue->events[i] = queue->events[parent];
+        i = parent;
+    }
+    queue->events[i] = event;
+}
+
+// Remove the earliest event; returns false if there is none
+bool popEvent(EventQueue* queue, SimEvent* event) {
+    if (queue->size == 0) {
+        return false;
+    }
+    *event = queue->events[0];
+
+    SimEvent last = queue->events[--queue->size];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= queue->size) break;
+        if (child + 1 < queue->size && eventBefore(&queue->events[child + 1], &queue->events[child])) {
+            child++;
+        }
+        if (!eventBefore(&queue->events[child], &last)) break;
+        queue->events[i] = queue->events[child];
+        i = child;
+    }
+    if (queue->size > 0) {
+        queue->events[i] = last;
+    }
+    return true;
+}
+
+// Time of the earliest event, or INFINITY when the queue is empty
+double nextEventTime(const EventQueue* queue) {
+    return queue->size > 0 ? queue->events[0].time : INFINITY;
+}
+
+// Initialize a new queue, or empty one that is already allocated
+void initQueue(TrafficQueue* queue) {
+    if (queue->vehicleIndices == NULL) {
+        queue->vehicleIndices = malloc(INITIAL_QUEUE_CAPACITY * sizeof(int));
+        if (queue->vehicleIndices == NULL) {
+            perror("Failed to allocate lane queue");
+            exit(1);
+        }
+        queue->capacity = INITIAL_QUEUE_CAPACITY;
+    }
+    queue->front = 0;
+    queue->rear = -1;
+    queue->size = 0;
+}
+
+void initTrafficLights() {
+    publishLights(0);
+    for (int i = 0; i < 4; i++) {
+        initQueue(&laneQueues[i]); // Initialize all lane queues
+        atomic_store(&queueLength[i], 0);
+    }
+}
+LightPhase readLightPhase() {
+    return atomic_load_explicit(&lightPhase, memory_order_acquire);
+}
+
+// Switch the lights to the lanes set in greenMask, all at once
+void publishLights(unsigned greenMask) {
+    LightPhase old = atomic_load_explicit(&lightPhase, memory_order_relaxed);
+    LightPhase next;
+    do {
+        next = (LIGHT_VERSION(old) + 1) << LIGHT_VERSION_SHIFT | greenMask;
+    } while (!atomic_compare_exchange_weak_explicit(&lightPhase, &old, next,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+// Check if queue is empty
+bool isQueueEmpty(TrafficQueue* queue) {
+    return queue->size == 0;
+}
+
+// Check if queue is full; the next enqueue will have to grow it
+bool isQueueFull(TrafficQueue* queue) {
+    return queue->size == queue->capacity;
+}
+
+// Double the ring buffer, unwrapping it so the front lands at index 0
+static bool growQueue(TrafficQueue* queue) {
+    int capacity = queue->capacity * 2;
+    int* indices = malloc(capacity * sizeof(int));
+    if (indices == NULL) {
+        return false;
+    }
+    for (int n = 0; n < queue->size; n++) {
+        indices[n] = queue->vehicleIndices[(queue->front + n) % queue->capacity];
+    }
+    free(queue->vehicleIndices);
+    queue->vehicleIndices = indices;
+    queue->capacity = capacity;
+    queue->front = 0;
+    queue->rear = queue->size - 1;
+    return true;
+}
+
+// Add a vehicle index to the queue
+bool enqueue(TrafficQueue* queue, int vehicleIndex) {
+    if (isQueueFull(queue) && !growQueue(queue)) {
+        return false;
+    }
+    
+    queue->rear = (queue->rear + 1) % queue->capacity;
+    queue->vehicleIndices[queue->rear] = vehicleIndex;
+    queue->size++;
+    return true;
+}
+
+// Remove a vehicle index from the queue
+int dequeue(TrafficQueue* queue) {
+    if (isQueueEmpty(queue)) {
+        return -1; // Error: Empty queue
+    }
+    
+    int vehicleIndex = queue->vehicleIndices[queue->front];
+    queue->front = (queue->front + 1) % queue->capacity;
+    queue->size--;
+    return vehicleIndex;
+}
+
+// Remove a vehicle index wherever it is; normally it is the front
+bool removeFromQueue(TrafficQueue* queue, int vehicleIndex) {
+    if (peek(queue) == vehicleIndex) {
+        dequeue(queue);
+        return true;
+    }
+    
+    // Out of order: close the gap by shifting the later entries forward
+    for (int n = 0; n < queue->size; n++) {
+        int pos = (queue->front + n) % queue->capacity;
+        if (queue->vehicleIndices[pos] != vehicleIndex) continue;
+        for (int m = n + 1; m < queue->size; m++) {
+            int next = (queue->front + m) % queue->capacity;
+            queue->vehicleIndices[pos] = queue->vehicleIndices[next];
+            pos = next;
+        }
+        queue->rear = (queue->rear - 1 + queue->capacity) % queue->capacity;
+        queue->size--;
+        return true;
+    }
+    return false;
+}
+
+// Get front of queue without removing
+int peek(TrafficQueue* queue) {
+    if (isQueueEmpty(queue)) {
+        return -1; // Error: Empty queue
+    }
+    
+    return queue->vehicleIndices[queue->front];
+}
+
+
+// Count the number of vehicles in each lane
+void countVehiclesPerLane(int laneQueue[], int sublane) {
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        laneQueue[lane] += laneOccupancy('A' + lane, sublane);
+    }
+}
+
+int laneOccupancy(char lane, int sublane) {
+    return atomic_load_explicit(&occupancyCount[lane - 'A'][sublane - 1], memory_order_relaxed);
+}
+
+
+int laneWaiting(char lane, int sublane) {
+    return atomic_load_explicit(&waitingCount[lane - 'A'][sublane - 1], memory_order_relaxed);
+}
+
+int laneQueueLength(int lane) {
+    return atomic_load_explicit(&queueLength[lane], memory_order_relaxed);
+}
+
+// Update traffic lights dynamically
+void* updateTrafficLights(void* arg) {
+    int participant = simClockRegister(&simClock);
+    while (1) {
+        int laneCounts[4] = {0};
+        
+        // Count vehicles in sublane 2 at intersections A, B, C, and D
+        countVehiclesPerLane(laneCounts, 2);
+
+        // Default priority lane
+        int priorityLane = -1; 
+        for (int i = 0; i < 4; i++) {
+            if (laneCounts[i] >= 3) { 
+                priorityLane = i; // Prioritize lanes with 3+ vehicles in sublane 2
+                break;
+            }
+        }
+
+        // All sublane 2 lights red except the priority lane, if any
+        publishLights(priorityLane != -1 ? 1u << priorityLane : 0);
+
+        simClockSleep(&simClock, participant, 5); // Give time for vehicles to clear
+    }
+    return NULL;
+}
+
+
+// Lane queue a vehicle belongs in: sublane 2 vehicles inside the detection
+// zone, which runs from 3 * STOP_DISTANCE before the centre of the junction
+// up to the centre, -1 for everything else
+int detectionZoneLane(int index) {
+    // Only consider vehicles in sublane 2 (straight lane)
+    if (!vehicles.active[index] || vehicles.sublane[index] != 2) return -1;
+    
+    switch (vehicles.lane[index]) {
+        case 'A':
+            // Vehicle approaching from left - increase detection range
+            if (vehicles.x[index] >= (WINDOW_WIDTH / 2 - STOP_DISTANCE * 3) && 
+                vehicles.x[index] < (WINDOW_WIDTH / 2)) {
+                return 0;
+            }
+            break;
+            
+        case 'B':
+            // Vehicle approaching from right - increase detection range
+            if (vehicles.x[index] <= (WINDOW_WIDTH / 2 + STOP_DISTANCE * 3) && 
+                vehicles.x[index] > (WINDOW_WIDTH / 2)) {
+                return 1;
+            }
+            break;
+            
+        case 'C':
+            // Vehicle approaching from top - increase detection range
+            if (vehicles.y[index] >= (WINDOW_HEIGHT / 2 - STOP_DISTANCE * 3) && 
+                vehicles.y[index] < (WINDOW_HEIGHT / 2)) {
+                return 2;
+            }
+            break;
+            
+        case 'D':
+            // Vehicle approaching from bottom - increase detection range
+            if (vehicles.y[index] <= (WINDOW_HEIGHT / 2 + STOP_DISTANCE * 3) && 
+                vehicles.y[index] > (WINDOW_HEIGHT / 2)) {
+                return 3;
+            }
+            break;
+    }
+    return -1;
+}
+
+// Set when a queue change needs a controller decision; the controller thread,
+// if there is one, is also woken on the simulated clock
+static atomic_bool controllerWakePending;
+static atomic_int controllerParticipant = -1;
+
+static void wakeController() {
+    if (atomic_exchange(&controllerWakePending, true)) return; // already pending
+    int participant = atomic_load(&controllerParticipant);
+    if (participant >= 0) {
+        simClockNotify(&simClock, participant);
+    }
+}
+
+// Clear and return the pending wake-up; the controller calls this before
+// deciding so that later changes wake it again
+bool takeControllerWake() {
+    return atomic_exchange(&controllerWakePending, false);
+}
+
+// Only some queue changes can alter the controller's decision: a lane
+// emptying or starting to fill, and any change above the priority threshold,
+// which covers crossing it in either direction
+static void queueChanged(int lane, int oldSize) {
+    int size = laneQueues[lane].size;
+    atomic_store_explicit(&queueLength[lane], size, memory_order_relaxed);
+    if (oldSize == 0 || size == 0 ||
+        oldSize > PRIORITY_QUEUE_THRESHOLD || size > PRIORITY_QUEUE_THRESHOLD) {
+        wakeController();
+    }
+}
+
+// Keep laneQueues in step with one vehicle: enqueue it when it enters the
+// detection zone, dequeue it when it leaves the zone at the centre of the
+// junction (past the stop line, which is 150 px before it) or leaves the
+// lane. The caller holds vehicleMutex.
+void updateVehicleQueue(int index) {
+    int zone = detectionZoneLane(index);
+    if (zone == vehicles.queuedLane[index]) return;
+    
+    int queued = vehicles.queuedLane[index];
+    if (queued != -1) {
+        int oldSize = laneQueues[queued].size;
+        removeFromQueue(&laneQueues[queued], index);
+        vehicles.queuedLane[index] = -1;
+        queueChanged(queued, oldSize);
+    }
+    if (zone != -1) {
+        int oldSize = laneQueues[zone].size;
+        // A vehicle missing from its queue would starve the controller
+        if (!enqueue(&laneQueues[zone], index)) {
+            perror("Failed to grow lane queue");
+            exit(1);
+        }
+        vehicles.queuedLane[index] = zone;
+        queueChanged(zone, oldSize);
+    }
+}
+
+// Helper function to calculate green light duration based on vehicle count
+int calculateGreenLightDuration(int vehicleCount) {
+    // Assume each vehicle takes approximately 2 seconds to clear the intersection
+    // Plus a base time of 3 seconds for the first vehicle
+    int baseTime = 3;
+    int timePerVehicle = 2;
+    
+    return baseTime + (vehicleCount * timePerVehicle);
+}
+
+void initTrafficController(TrafficController* ctrl, double now) {
+    ctrl->currentServingLane = -1;
+    ctrl->lastRotationTime = now;
+    ctrl->normalRotationDuration = 5; // 5 seconds per lane in normal rotation
+    ctrl->phaseChanges = 0;
+    ctrl->verbose = true;
+}
+
+// Give the green light to a single lane and record the phase change; the
+// decision is only logged when the lights actually change
+static void serveLane(TrafficController* ctrl, int lane, const char* reason) {
+    if (lane == ctrl->currentServingLane) return;
+
+    publishLights(lane != -1 ? 1u << lane : 0);
+    ctrl->currentServingLane = lane;
+    if (ctrl->verbose) {
+        char decision[20] = "all lanes red";
+        if (lane != -1) {
+            snprintf(decision, sizeof(decision), "lane %c2 gets green", 'A' + lane);
+        }
+        printf("%s: %s (queues A2:%d, B2:%d, C2:%d, D2:%d)\n", reason, decision,
+               laneQueueLength(0), laneQueueLength(1), laneQueueLength(2), laneQueueLength(3));
+    }
+    if (lane == -1) return;
+    ctrl->phaseChanges++;
+}
+
+// One decision of the advanced controller, based on the current lane queues.
+// Returns the simulated time of the next timed decision (the end of the
+// current rotation slot), or INFINITY when only a queue change can alter it.
+double trafficControllerStep(TrafficController* ctrl, double now) {
+    int highestPriorityLane = -1;
+    
+    // All lanes are in sublane 2
+    int numLanes = 4;
+    int lane_C_index = 2; // Lane C2 has special priority
+    
+    // Check for priority conditions
+    bool anyHighPriority = false;
+    
+    // First check if C2 has more than 5 vehicles - it gets absolute priority
+    if (laneQueueLength(lane_C_index) > PRIORITY_QUEUE_THRESHOLD) {
+        highestPriorityLane = lane_C_index;
+        anyHighPriority = true;
+    }
+    // If C2 doesn't have priority, check other lanes
+    else {
+        int maxVehicles = PRIORITY_QUEUE_THRESHOLD;
+        
+        // Find lane with most vehicles (above threshold)
+        for (int i = 0; i < numLanes; i++) {
+            // Skip C2 as we already checked it
+            if (i == lane_C_index) continue;
+            
+            if (laneQueueLength(i) > maxVehicles) {
+                maxVehicles = laneQueueLength(i);
+                highestPriorityLane = i;
+                anyHighPriority = true;
+            }
+        }
+    }
+    
+    // Handle high priority mode
+    if (anyHighPriority) {
+        // Give green light to priority lane
+        serveLane(ctrl, highestPriorityLane, "HIGH PRIORITY MODE");
+        
+        // Reset normal rotation timing
+        ctrl->lastRotationTime = now;
+    }
+    // Handle normal mode (no high priority lanes)
+    else {
+        // Check if current lane's green light duration is over or if we need to select a lane
+        if (ctrl->currentServingLane == -1 || 
+            now >= ctrl->lastRotationTime + ctrl->normalRotationDuration ||
+            laneQueueLength(ctrl->currentServingLane) == 0) {
+            
+            // Find lane with most waiting vehicles
+            int maxWaitingLane = -1;
+            int maxWaitingCount = 0;
+            
+            for (int i = 0; i < numLanes; i++) {
+                if (laneQueueLength(i) > maxWaitingCount) {
+                    maxWaitingCount = laneQueueLength(i);
+                    maxWaitingLane = i;
+                }
+            }
+            
+            // Serve the lane with the most vehicles, or none if all are empty
+            serveLane(ctrl, maxWaitingLane, "NORMAL MODE");
+            if (maxWaitingLane != -1) {
+                ctrl->lastRotationTime = now;
+            }
+        }
+    }
+    
+    // Same expression as the expiry test above, so a slot that was not over
+    // at now never ends at or before now
+    double nextDecision = ctrl->currentServingLane == -1 ? INFINITY
+                        : ctrl->lastRotationTime + ctrl->normalRotationDuration;
+    if (nextDecision <= now) {
+        nextDecision = nextafter(now, INFINITY); // callers must make progress
+    }
+    return nextDecision;
+}
+
+// Controller thread: sleeps on the simulated clock until the rotation slot
+// ends or a lane queue change wakes it, so it costs nothing while idle
+void* updateTrafficLightsAdvanced(void* arg) {
+    int participant = simClockRegister(&simClock);
+    TrafficController ctrl;
+    initTrafficController(&ctrl, simClockNow(&simClock));
+    atomic_store(&controllerParticipant, participant);
+    
+    while (1) {
+        takeControllerWake();
+        double now = simClockNow(&simClock);
+        double nextDecision = trafficControllerStep(&ctrl, now);
+        simClockSleep(&simClock, participant, nextDecision - now);
+    }
+    
+    return NULL;
+}
+
+// Function to determine route type based on source and target lanes
+int getRouteType(char source_lane, int source_sublane, char target_lane, int target_sublane) {
+    if (source_lane == 'A') {
+        if (source_sublane == 1 && target_lane == 'C') return LEFT_TURN;
+        if (source_sublane == 2 && target_lane == 'B') return STRAIGHT;
+        if (source_sublane == 3 && target_lane == 'D') return RIGHT_TURN;
+    }
+    // Add similar logic for other lanes
+    // For lane B
+    if (source_lane == 'B') {
+        if (source_sublane == 1 && target_lane == 'D') return LEFT_TURN;
+        if (source_sublane == 2 && target_lane == 'A') return STRAIGHT;
+        if (source_sublane == 3 && target_lane == 'C') return RIGHT_TURN;
+    }
+    // For lane C
+    if (source_lane == 'C') {
+        if (source_sublane == 1 && target_lane == 'B') return LEFT_TURN;
+        if (source_sublane == 2 && target_lane == 'D') return STRAIGHT;
+        if (source_sublane == 3 && target_lane == 'A') return RIGHT_TURN;
+    }
+    // For lane D
+    if (source_lane == 'D') {
+        if (source_sublane == 1 && target_lane == 'A') return LEFT_TURN;
+        if (source_sublane == 2 && target_lane == 'C') return STRAIGHT;
+        if (source_sublane == 3 && target_lane == 'B') return RIGHT_TURN;
+    }
+    return STRAIGHT; // Default case
+}
+
+
+// Convert lane letter and number to screen coordinates
+void getLanePosition(char lane, int sublane, int* x, int* y) {
+    int center_x = WINDOW_WIDTH / 2;
+    int center_y = WINDOW_HEIGHT / 2;
+
+    switch (lane) {
+        case 'A': // Left side lanes (moving right)
+            *x = 0;  // Start from the left
+            *y = center_y - ROAD_WIDTH / 2 + (sublane - 1) * LANE_WIDTH + LANE_WIDTH / 2; // Centered
+            break;
+
+        case 'B': // Right side lanes (moving left)
+            *x = WINDOW_WIDTH; // Start from the right
+            *y = center_y + ROAD_WIDTH / 2 - (sublane - 1) * LANE_WIDTH - LANE_WIDTH / 2; // Centered
+            break;
+
+        case 'C': // Top side lanes (moving down)
+            *x = center_x - ROAD_WIDTH / 2 + (sublane - 1) * LANE_WIDTH + LANE_WIDTH / 2; // Centered
+            *y = 0; // Start from the top
+            break;
+
+        case 'D': // Bottom side lanes (moving up)
+            *x = center_x + ROAD_WIDTH / 2 - (sublane - 1) * LANE_WIDTH - LANE_WIDTH / 2; // Centered
+            *y = WINDOW_HEIGHT; // Start from the bottom
+            break;
+    }
+}
+
+// Routes through the junction, one per entry lane, sublane and turn choice.
+// A route is a chain of segments starting at the spawn point of its entry
+// lane; each segment ends at (x, y), and a curved one bends towards its
+// control point as a quadratic Bezier. A vehicle carries the lane and
+// sublane of the segment it is on, so lane changes happen where two
+// segments meet. Routes run until the vehicle has left the world.
+typedef struct {
+    bool curved;
+    float controlX, controlY;
+    float x, y;
+    char lane;
+    int sublane;
+} RouteSegment;
+
+#define MAX_ROUTE_SEGMENTS 3
+typedef struct {
+    char lane;
+    int sublane;
+    int choice; // turn choice that picks this route, -1 for either
+    int segmentCount;
+    RouteSegment segments[MAX_ROUTE_SEGMENTS];
+} RouteDefinition;
+
+#define CX (WINDOW_WIDTH / 2)
+#define CY (WINDOW_HEIGHT / 2)
+#define EXIT_LEFT (-VEHICLE_LENGTH - 1)
+#define EXIT_RIGHT (WINDOW_WIDTH + VEHICLE_LENGTH + 1)
+#define EXIT_TOP (-VEHICLE_LENGTH - 1)
+#define EXIT_BOTTOM (WINDOW_HEIGHT + VEHICLE_LENGTH + 1)
+#define LINE(x, y, lane, sublane) { false, 0, 0, x, y, lane, sublane }
+#define CURVE(controlX, controlY, x, y, lane, sublane) { true, controlX, controlY, x, y, lane, sublane }
+
+static const RouteDefinition routeDefinitions[] = {
+    { 'A', 1, -1, 3, { LINE(CX - 75, CY - 70, 'A', 1), LINE(CX - 70, CY - 75, 'A', 1),
+                       LINE(CX - 70, EXIT_TOP, 'D', 1) } },
+    { 'A', 2, 0, 3, { LINE(CX - 75, CY, 'A', 2), LINE(CX - 3, CY - 72, 'A', 2),
+                      LINE(EXIT_RIGHT, CY - 72, 'A', 1) } },
+    { 'A', 2, 1, 3, { LINE(CX - 75, CY, 'A', 2), CURVE(CX, CY - 20, CX + 75, CY + 150, 'A', 2),
+                      LINE(CX + 75, EXIT_BOTTOM, 'C', 3) } },
+    { 'A', 3, -1, 1, { LINE(EXIT_RIGHT, CY + 70, 'A', 3) } },
+    { 'B', 1, -1, 2, { LINE(CX + 75, CY + 70, 'B', 1), LINE(CX + 75, EXIT_BOTTOM, 'C', 1) } },
+    { 'B', 2, 0, 3, { LINE(CX, CY, 'B', 2), LINE(CX - 75, CY + 75, 'B', 2),
+                      LINE(EXIT_LEFT, CY + 75, 'B', 3) } },
+    { 'B', 2, 1, 3, { LINE(CX, CY, 'B', 2), LINE(CX - 75, CY - 75, 'B', 2),
+                      LINE(CX - 75, EXIT_TOP, 'D', 1) } },
+    { 'B', 3, -1, 1, { LINE(EXIT_LEFT, CY - 70, 'B', 3) } },
+    { 'C', 1, -1, 1, { LINE(CX - 70, EXIT_BOTTOM, 'C', 1) } },
+    { 'C', 2, 0, 3, { LINE(CX, CY, 'C', 2), LINE(CX - 75, CY + 75, 'C', 2),
+                      LINE(EXIT_LEFT, CY + 75, 'B', 3) } },
+    { 'C', 2, 1, 3, { LINE(CX, CY, 'C', 2), LINE(CX + 75, CY + 75, 'C', 2),
+                      LINE(CX + 75, EXIT_BOTTOM, 'C', 3) } },
+    { 'C', 3, -1, 2, { LINE(CX + 70, CY - 75, 'C', 3), LINE(EXIT_RIGHT, CY - 75, 'A', 1) } },
+    { 'D', 1, -1, 1, { LINE(CX + 70, EXIT_TOP, 'D', 1) } },
+    { 'D', 2, 0, 3, { LINE(CX, CY, 'D', 2), LINE(CX - 75, CY - 75, 'D', 2),
+                      LINE(CX - 75, EXIT_TOP, 'D', 1) } },
+    { 'D', 2, 1, 3, { LINE(CX, CY, 'D', 2), LINE(CX + 75, CY - 75, 'D', 2),
+                      LINE(EXIT_RIGHT, CY - 75, 'A', 1) } },
+    { 'D', 3, -1, 3, { LINE(CX - 70, CY + 75, 'D', 3), LINE(CX - 75, CY + 70, 'D', 3),
+                       LINE(EXIT_LEFT, CY + 70, 'B', 3) } },
+};
+#define NUM_ROUTES (int)(sizeof(routeDefinitions) / sizeof(routeDefinitions[0]))
+
+#undef LINE
+#undef CURVE
+
+// A route flattened into points every ROUTE_SAMPLE_SPACING pixels of arc
+// length, so moving a vehicle is an index and one interpolation and its
+// speed is the same on curves as on straights
+#define ROUTE_SAMPLE_SPACING 1.0f
+#define CURVE_PIECES 64 // chords used to measure a curved segment
+typedef struct {
+    const RouteDefinition* definition;
+    float length;
+    float segmentEnd[MAX_ROUTE_SEGMENTS]; // arc length at the end of each segment
+    int sampleCount;
+    float* x;
+    float* y;
+} RouteTable;
+
+static RouteTable routeTables[NUM_ROUTES];
+static unsigned char routeFor[NUM_LANES][3][2]; // by lane, sublane and choice
+static pthread_once_t routeTablesOnce = PTHREAD_ONCE_INIT;
+
+static void buildRouteTable(const RouteDefinition* definition, RouteTable* table) {
+    // Trace the route as a polyline with the arc length at every point
+    float px[1 + MAX_ROUTE_SEGMENTS * CURVE_PIECES];
+    float py[1 + MAX_ROUTE_SEGMENTS * CURVE_PIECES];
+    float ps[1 + MAX_ROUTE_SEGMENTS * CURVE_PIECES];
+    int startX, startY;
+    getLanePosition(definition->lane, definition->sublane, &startX, &startY);
+    px[0] = startX;
+    py[0] = startY;
+    ps[0] = 0.0f;
+    int n = 1;
+    for (int k = 0; k < definition->segmentCount; k++) {
+        const RouteSegment* segment = &definition->segments[k];
+        float x0 = px[n - 1], y0 = py[n - 1];
+        int pieces = segment->curved ? CURVE_PIECES : 1;
+        for (int j = 1; j <= pieces; j++) {
+            float x = segment->x, y = segment->y;
+            if (segment->curved) {
+                calculateBezierCurve(x0, y0, segment->controlX, segment->controlY,
+                                     segment->x, segment->y, (float)j / pieces, &x, &y);
+            }
+            ps[n] = ps[n - 1] + hypotf(x - px[n - 1], y - py[n - 1]);
+            px[n] = x;
+            py[n] = y;
+            n++;
+        }
+        table->segmentEnd[k] = ps[n - 1];
+    }
+
+    // Resample it at even arc-length steps
+    table->definition = definition;
+    table->length = ps[n - 1];
+    table->sampleCount = (int)ceilf(table->length / ROUTE_SAMPLE_SPACING) + 1;
+    table->x = malloc(table->sampleCount * sizeof(float));
+    table->y = malloc(table->sampleCount * sizeof(float));
+    if (table->x == NULL || table->y == NULL) {
+        perror("Failed to allocate route table");
+        exit(1);
+    }
+    int j = 1;
+    for (int k = 0; k < table->sampleCount; k++) {
+        float s = fminf(k * ROUTE_SAMPLE_SPACING, table->length);
+        while (j < n - 1 && ps[j] < s) j++;
+        float span = ps[j] - ps[j - 1];
+        float f = span > 0.0f ? (s - ps[j - 1]) / span : 0.0f;
+        table->x[k] = px[j - 1] + (px[j] - px[j - 1]) * f;
+        table->y[k] = py[j - 1] + (py[j] - py[j - 1]) * f;
+    }
+}
+
+static void buildRouteTables() {
+    for (int r = 0; r < NUM_ROUTES; r++) {
+        const RouteDefinition* definition = &routeDefinitions[r];
+        buildRouteTable(definition, &routeTables[r]);
+        for (int choice = 0; choice < 2; choice++) {
+            if (definition->choice == -1 || definition->choice == choice) {
+                routeFor[definition->lane - 'A'][definition->sublane - 1][choice] = r;
+            }
+        }
+    }
+}
+
+// Resize every pool array and the free-slot stack. realloc keeps the
+// contents, and since vehicles are addressed by index nothing dangles.
+// On failure the pool keeps its old capacity; arrays that were already
+// enlarged are simply bigger than needed.
+static bool resizeVehiclePool(int capacity) {
+#define RESIZE(array) do { \
+        void* grown = realloc(array, capacity * sizeof(*(array))); \
+        if (grown == NULL) return false; \
+        array = grown; \
+    } while (0)
+    RESIZE(vehicles.x);
+    RESIZE(vehicles.y);
+    RESIZE(vehicles.speed);
+    RESIZE(vehicles.lane);
+    RESIZE(vehicles.sublane);
+    RESIZE(vehicles.active);
+    RESIZE(vehicles.route);
+    RESIZE(vehicles.junctionOrder);
+    RESIZE(vehicles.routeDistance);
+    RESIZE(vehicles.queuedLane);
+    RESIZE(vehicles.laneAhead);
+    RESIZE(vehicles.laneBehind);
+    RESIZE(vehicles.info);
+    RESIZE(freeSlots);
+#undef RESIZE
+    vehicles.capacity = capacity;
+    return true;
+}
+
+// Double the pool and push the new slots onto the free-list; the caller
+// holds vehicleMutex
+static bool growVehiclePool() {
+    int oldCapacity = vehicles.capacity;
+    if (!resizeVehiclePool(oldCapacity * 2)) {
+        return false;
+    }
+    for (int i = vehicles.capacity - 1; i >= oldCapacity; i--) {
+        vehicles.active[i] = false;
+        freeSlots[freeSlotCount++] = i; // lowest index on top
+    }
+    return true;
+}
+
+// Allocate the pool with room for capacity vehicles; it grows past that
+// on demand
+void initVehicles(int capacity) {
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    pthread_once(&routeTablesOnce, buildRouteTables);
+    if (!resizeVehiclePool(capacity)) {
+        perror("Failed to allocate vehicle pool");
+        exit(1);
+    }
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        for (int sublane = 0; sublane < 3; sublane++) {
+            laneLists[lane][sublane].front = -1;
+            laneLists[lane][sublane].back = -1;
+            atomic_store(&occupancyCount[lane][sublane], 0);
+            atomic_store(&waitingCount[lane][sublane], 0);
+        }
+    }
+    freeSlotCount = 0;
+    simStats.activeVehicles = 0;
+    for (int i = vehicles.capacity - 1; i >= 0; i--) {
+        vehicles.active[i] = false;
+        freeSlots[freeSlotCount++] = i; // lowest index on top
+    }
+}
+
+// Distance travelled along a lane's direction; larger means further ahead
+static float progressAlong(char lane, float x, float y) {
+    switch (lane) {
+        case 'A': return x;
+        case 'B': return -x;
+        case 'C': return y;
+        default:  return -y;
+    }
+}
+
+float laneProgress(int index) {
+    return progressAlong(vehicles.lane[index], vehicles.x[index], vehicles.y[index]);
+}
+
+static LaneList* laneListOf(char lane, int sublane) {
+    return &laneLists[lane - 'A'][sublane - 1];
+}
+
+static void laneListLink(LaneList* list, int index, int ahead, int behind) {
+    vehicles.laneAhead[index] = ahead;
+    vehicles.laneBehind[index] = behind;
+    if (ahead != -1) vehicles.laneBehind[ahead] = index; else list->front = index;
+    if (behind != -1) vehicles.laneAhead[behind] = index; else list->back = index;
+}
+
+// A vehicle joins or leaves the counters of a lane together with its list
+static void laneCountersAdd(int index, char lane, int sublane, int delta) {
+    atomic_fetch_add_explicit(&occupancyCount[lane - 'A'][sublane - 1], delta, memory_order_relaxed);
+    if (vehicles.speed[index] < IDM_STOP_SPEED) {
+        atomic_fetch_add_explicit(&waitingCount[lane - 'A'][sublane - 1], delta, memory_order_relaxed);
+    }
+}
+
+// Unlink a vehicle from the list of the lane it was in
+void laneListRemove(int index, char lane, int sublane) {
+    LaneList* list = laneListOf(lane, sublane);
+    int ahead = vehicles.laneAhead[index];
+    int behind = vehicles.laneBehind[index];
+    if (ahead != -1) vehicles.laneBehind[ahead] = behind; else list->front = behind;
+    if (behind != -1) vehicles.laneAhead[behind] = ahead; else list->back = ahead;
+    vehicles.laneAhead[index] = vehicles.laneBehind[index] = -1;
+    laneCountersAdd(index, lane, sublane, -1);
+}
+
+// Insert a vehicle into its current lane's list, searching from the back
+// since new arrivals usually join the end of the lane
+void laneListInsert(int index) {
+    LaneList* list = laneListOf(vehicles.lane[index], vehicles.sublane[index]);
+    float progress = laneProgress(index);
+    int behind = -1;
+    int ahead = list->back;
+    while (ahead != -1 && laneProgress(ahead) < progress) {
+        behind = ahead;
+        ahead = vehicles.laneAhead[ahead];
+    }
+    laneListLink(list, index, ahead, behind);
+    laneCountersAdd(index, vehicles.lane[index], vehicles.sublane[index], 1);
+}
+
+// Move a vehicle forward in its list if it has overtaken the entry ahead
+void laneListRestoreOrder(int index) {
+    int ahead = vehicles.laneAhead[index];
+    if (ahead == -1 || laneProgress(ahead) >= laneProgress(index)) return;
+    laneListRemove(index, vehicles.lane[index], vehicles.sublane[index]);
+    laneListInsert(index);
+}
+
+// Return a vehicle's slot to the free-list; the caller holds vehicleMutex
+void retireVehicle(int index) {
+    if (!vehicles.active[index]) return;
+    laneListRemove(index, vehicles.lane[index], vehicles.sublane[index]);
+    vehicles.active[index] = false;
+    updateVehicleQueue(index);
+    freeSlots[freeSlotCount++] = index;
+    simStats.vehiclesRetired++;
+    simStats.activeVehicles--;
+}
+
+int getDirection(char lane) {
+    return (lane == 'A' || lane == 'C') ? 1 : -1;
+}
+
+static bool isSpawnLane(char lane, int sublane) {
+    // Prevent spawning in Lane A, Sublane 3
+    if (lane == 'A' && sublane == 3) {
+        return false; // Skip this vehicle
+    }
+    return lane >= 'A' && lane <= 'D' && sublane >= 1 && sublane <= 3;
+}
+
+// Mesoscopic mode, for capacity studies where positions don't matter.
+// Vehicles exist only as entries in the lane queues and timed events: an
+// arrival in the straight sublane joins its lane queue after the free-flow
+// time to the detection zone, and a green lane lets one queued vehicle go
+// every headway, by default the per-vehicle time of
+// calculateGreenLightDuration(). Turning sublanes never meet a light, so
+// their vehicles simply take their route's free-flow time. The queues,
+// counters and controller are the same as in the full model; queue entries
+// hold route numbers instead of vehicle slots.
+enum {
+    MESO_JOIN, // data: route of a vehicle reaching its lane's detection zone
+    MESO_EXIT  // a vehicle leaves the world
+};
+
+static bool mesoscopic;
+static EventQueue mesoEvents;
+static double mesoHeadway; // seconds between two vehicles leaving a green lane
+static double mesoDischargeAt[NUM_LANES]; // next vehicle off a green lane, INFINITY if none
+
+// Switch arrivals to the mesoscopic model; a headway of 0 takes the
+// per-vehicle time of calculateGreenLightDuration()
+void initMesoscopic(double headway) {
+    mesoscopic = true;
+    mesoHeadway = headway > 0 ? headway : calculateGreenLightDuration(1) - calculateGreenLightDuration(0);
+    initEventQueue(&mesoEvents);
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        mesoDischargeAt[lane] = INFINITY;
+    }
+}
+
+// Progress along an approach at which its detection zone starts
+static float detectionZoneStart(char lane) {
+    switch (lane) {
+        case 'A': return progressAlong('A', WINDOW_WIDTH / 2 - STOP_DISTANCE * 3, 0);
+        case 'B': return progressAlong('B', WINDOW_WIDTH / 2 + STOP_DISTANCE * 3, 0);
+        case 'C': return progressAlong('C', 0, WINDOW_HEIGHT / 2 - STOP_DISTANCE * 3);
+        default:  return progressAlong('D', 0, WINDOW_HEIGHT / 2 + STOP_DISTANCE * 3);
+    }
+}
+
+// Free-flow distance from a lane's spawn point to where the queue is left
+static float distanceToCenter(char lane, int sublane) {
+    int x, y;
+    getLanePosition(lane, sublane, &x, &y);
+    return progressAlong(lane, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2) - progressAlong(lane, x, y);
+}
+
+// Take an arrival in mesoscopic mode; the caller holds vehicleMutex
+static void mesoArrive(char lane, int sublane, int choice) {
+    if (choice != 0 && choice != 1) {
+        choice = simRandomNext(&vehicleRandom) % 2;
+    }
+    int route = routeFor[lane - 'A'][sublane - 1][choice];
+    double now = simClockNow(&simClock);
+    if (sublane == 2) {
+        int x, y;
+        getLanePosition(lane, sublane, &x, &y);
+        float toZone = detectionZoneStart(lane) - progressAlong(lane, x, y);
+        scheduleEvent(&mesoEvents, now + fmaxf(toZone, 0.0f) / IDM_DESIRED_SPEED, MESO_JOIN, route);
+    } else {
+        scheduleEvent(&mesoEvents, now + routeTables[route].length / IDM_DESIRED_SPEED, MESO_EXIT, 0);
+    }
+    simStats.vehiclesSpawned++;
+    if (++simStats.activeVehicles > simStats.peakActiveVehicles) {
+        simStats.peakActiveVehicles = simStats.activeVehicles;
+    }
+}
+
+// Next time anything happens in the mesoscopic model
+double mesoNextEventTime() {
+    double next = nextEventTime(&mesoEvents);
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        next = fmin(next, mesoDischargeAt[lane]);
+    }
+    return next;
+}
+
+// Bring the mesoscopic model up to now: joins, exits, and discharges from
+// the lanes that are green. Call again after the lights change.
+void mesoAdvance(double now) {
+    double headway = mesoHeadway;
+    pthread_mutex_lock(&vehicleMutex);
+    SimEvent event;
+    while (nextEventTime(&mesoEvents) <= now && popEvent(&mesoEvents, &event)) {
+        if (event.type == MESO_JOIN) {
+            int lane = routeDefinitions[event.data].lane - 'A';
+            int oldSize = laneQueues[lane].size;
+            if (!enqueue(&laneQueues[lane], event.data)) {
+                perror("Failed to grow lane queue");
+                exit(1);
+            }
+            queueChanged(lane, oldSize);
+        } else {
+            simStats.vehiclesRetired++;
+            simStats.activeVehicles--;
+        }
+    }
+
+    LightPhase lights = readLightPhase();
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        if (!LIGHT_GREEN(lights, lane) || laneQueues[lane].size == 0) {
+            mesoDischargeAt[lane] = INFINITY;
+            continue;
+        }
+        if (mesoDischargeAt[lane] == INFINITY) {
+            mesoDischargeAt[lane] = now + headway; // the queue starts moving
+        }
+        while (mesoDischargeAt[lane] <= now && laneQueues[lane].size > 0) {
+            int oldSize = laneQueues[lane].size;
+            int route = dequeue(&laneQueues[lane]);
+            queueChanged(lane, oldSize);
+            const RouteDefinition* definition = &routeDefinitions[route];
+            float remaining = routeTables[route].length - distanceToCenter(definition->lane, definition->sublane);
+            scheduleEvent(&mesoEvents, mesoDischargeAt[lane] + remaining / IDM_DESIRED_SPEED, MESO_EXIT, 0);
+            mesoDischargeAt[lane] = laneQueues[lane].size > 0 ? mesoDischargeAt[lane] + headway : INFINITY;
+        }
+    }
+    pthread_mutex_unlock(&vehicleMutex);
+}
+
+// Place a vehicle in a free slot; the caller holds vehicleMutex and has
+// checked the lane. A choice of -1 draws the route at random. Returns its
+// index or -1 if it was dropped; in mesoscopic mode there is no slot and
+// the return value is 0
+static int placeVehicle(const char* id, char lane, int sublane, int choice) {
+    if (mesoscopic) {
+        mesoArrive(lane, sublane, choice);
+        return 0;
+    }
+    if (freeSlotCount == 0 && !growVehiclePool()) {
+        simStats.vehiclesDropped++;
+        return -1;
+    }
+
+    int i = freeSlots[--freeSlotCount];
+    vehicles.active[i] = true;
+    snprintf(vehicles.info[i].id, 9, "%s", id);
+    vehicles.lane[i] = lane;
+    vehicles.sublane[i] = sublane;
+    vehicles.info[i].direction = (lane == 'A' || lane == 'C') ? 1 : -1;
+    vehicles.info[i].serial = simStats.vehiclesSpawned + 1;
+    int x, y;
+    getLanePosition(lane, sublane, &x, &y);
+    vehicles.x[i] = x;
+    vehicles.y[i] = y;
+    vehicles.speed[i] = IDM_DESIRED_SPEED; // arrives at cruising speed
+
+    // Initialize the color attribute
+    vehicles.info[i].color = (VehicleColor){
+        simRandomNext(&vehicleRandom) % 256, simRandomNext(&vehicleRandom) % 256,
+        simRandomNext(&vehicleRandom) % 256, 255
+    };
+    if (choice != 0 && choice != 1) {
+        choice = simRandomNext(&vehicleRandom) % 2;
+    }
+    vehicles.route[i] = routeFor[lane - 'A'][sublane - 1][choice];
+    vehicles.routeDistance[i] = 0.0f;
+    vehicles.junctionOrder[i] = 0;
+    vehicles.queuedLane[i] = -1;
+    laneListInsert(i);
+    updateVehicleQueue(i);
+
+
+    // printf("Spawned Vehicle: %s at lane %c, sublane %d\n", vehicles.info[i].id, lane, sublane);
+    simStats.vehiclesSpawned++;
+    if (++simStats.activeVehicles > simStats.peakActiveVehicles) {
+        simStats.peakActiveVehicles = simStats.activeVehicles;
+    }
+    return i;
+}
+
+// Place a vehicle in a free slot; returns its index or -1 if it was dropped
+int spawnVehicle(const char* id, char lane, int sublane) {
+    if (!isSpawnLane(lane, sublane)) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&vehicleMutex);
+    int i = placeVehicle(id, lane, sublane, -1);
+    pthread_mutex_unlock(&vehicleMutex);
+    return i;
+}
+
+// Place a burst of arrivals in order under a single lock, growing the pool
+// once up front, for the requests with a valid lane only, rather than
+// vehicle by vehicle. accepted, if not NULL, gets one entry per request.
+// Returns how many vehicles were placed.
+int spawnVehicleBatch(const SpawnRequest* requests, int count, bool* accepted) {
+    int placed = 0;
+    int valid = 0;
+    for (int n = 0; n < count; n++) {
+        valid += isSpawnLane(requests[n].lane, requests[n].sublane);
+    }
+    pthread_mutex_lock(&vehicleMutex);
+    while (!mesoscopic && freeSlotCount < valid && growVehiclePool()) {
+        // whatever does not fit once growth fails is dropped below
+    }
+    for (int n = 0; n < count; n++) {
+        const SpawnRequest* request = &requests[n];
+        bool ok = isSpawnLane(request->lane, request->sublane) &&
+                  placeVehicle(request->id, request->lane, request->sublane, request->choice) != -1;
+        if (accepted != NULL) {
+            accepted[n] = ok;
+        }
+        placed += ok;
+    }
+    pthread_mutex_unlock(&vehicleMutex);
+    return placed;
+}
+
+// Bounded multi-producer ring of spawn requests (Vyukov's array queue).
+// Each cell's sequence says whose turn it is: equal to the position when
+// free for a producer, position + 1 once filled for the consumer. Producers
+// claim a position with a CAS on enqueuePos; the tick is the only consumer.
+typedef struct {
+    atomic_size_t sequence;
+    SpawnRequest request;
+} SpawnRingCell;
+
+static SpawnRingCell spawnRing[SPAWN_RING_SIZE];
+static _Alignas(64) atomic_size_t spawnEnqueuePos;
+static _Alignas(64) size_t spawnDequeuePos;
+static SpawnRequest drainBuffer[SPAWN_RING_SIZE]; // only touched by the consumer
+static atomic_long spawnOverflow; // requests turned away by a full ring since the last drain
+static pthread_once_t spawnRingOnce = PTHREAD_ONCE_INIT;
+
+static void initSpawnRing() {
+    for (size_t i = 0; i < SPAWN_RING_SIZE; i++) {
+        atomic_init(&spawnRing[i].sequence, i);
+    }
+}
+
+static bool tryPushSpawn(const SpawnRequest* request) {
+    pthread_once(&spawnRingOnce, initSpawnRing);
+    size_t pos = atomic_load_explicit(&spawnEnqueuePos, memory_order_relaxed);
+    while (1) {
+        SpawnRingCell* cell = &spawnRing[pos & (SPAWN_RING_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        long diff = (long)(sequence - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&spawnEnqueuePos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->request = *request;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // full: the consumer has not freed this cell yet
+        } else {
+            pos = atomic_load_explicit(&spawnEnqueuePos, memory_order_relaxed);
+        }
+    }
+}
+
+// Hand a vehicle to the simulation without taking vehicleMutex; it appears
+// at the next drainSpawnRequests(). If the ring is full the vehicle is
+// counted as dropped: spawning it directly would put it ahead of the
+// requests still in the ring and break the arrival order. The count is kept
+// apart and added to simStats by the drain, so producers never take the lock.
+void requestSpawn(const char* id, char lane, int sublane) {
+    SpawnRequest request;
+    snprintf(request.id, sizeof(request.id), "%s", id);
+    request.lane = lane;
+    request.sublane = sublane;
+    request.choice = -1;
+    if (!tryPushSpawn(&request)) {
+        atomic_fetch_add_explicit(&spawnOverflow, 1, memory_order_relaxed);
+    }
+}
+
+// Take every queued request off the ring and spawn them as one batch;
+// called by the tick, the only consumer. Returns how many were taken.
+int drainSpawnRequests() {
+    pthread_once(&spawnRingOnce, initSpawnRing);
+    int count = 0;
+    // Bounded so producers that never stop cannot hold the tick here
+    while (count < SPAWN_RING_SIZE) {
+        SpawnRingCell* cell = &spawnRing[spawnDequeuePos & (SPAWN_RING_SIZE - 1)];
+        if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != spawnDequeuePos + 1) {
+            break;
+        }
+        drainBuffer[count++] = cell->request;
+        atomic_store_explicit(&cell->sequence, spawnDequeuePos + SPAWN_RING_SIZE, memory_order_release);
+        spawnDequeuePos++;
+    }
+    if (count > 0) { // with nothing queued the lock is not touched
+        spawnVehicleBatch(drainBuffer, count, NULL);
+    }
+    long overflow = atomic_exchange_explicit(&spawnOverflow, 0, memory_order_relaxed);
+    if (overflow > 0) {
+        pthread_mutex_lock(&vehicleMutex);
+        simStats.vehiclesDropped += overflow;
+        pthread_mutex_unlock(&vehicleMutex);
+    }
+    return count;
+}
+
+// Pick a random lane that is allowed to receive traffic and a random id
+static void pickRandomSpawn(SpawnRequest* request) {
+    char lanes[] = {'A', 'B', 'C', 'D'};
+
+    while (1) {
+        int laneIndex = simRandomNext(&spawnRandom) % 4;
+        int sublane = (simRandomNext(&spawnRandom) % 3) + 1;
+
+
+        // Prevent spawning in `A3` and `D1`
+        if ((lanes[laneIndex] == 'A' && sublane == 3) ||(lanes[laneIndex] == 'B' && sublane == 3) || (lanes[laneIndex] == 'D' && sublane == 1) || (lanes[laneIndex] == 'C' && sublane == 1)) {
+            continue; // Skip this iteration
+        }
+
+        snprintf(request->id, sizeof(request->id), "V%03d", simRandomNext(&spawnRandom) % 1000);
+        request->lane = lanes[laneIndex];
+        request->sublane = sublane;
+        request->choice = -1;
+        return;
+    }
+}
+
+// Queue one vehicle on a random lane that is allowed to receive traffic; it
+// is placed at the next drainSpawnRequests()
+void spawnRandomVehicle() {
+    SpawnRequest request;
+    pickRandomSpawn(&request);
+    requestSpawn(request.id, request.lane, request.sublane);
+}
+
+void* generateVehicles(void* arg) {
+    int participant = simClockRegister(&simClock);
+
+    while (1) {
+        spawnRandomVehicle();
+        simClockSleep(&simClock, participant, VEHICLE_SPAWN_INTERVAL_MS / 1000.0);
+    }
+    return NULL;
+}
+
+//for curve turn from A2 to C3
+void calculateBezierCurve(float x0, float y0, float x1, float y1, float x2, float y2, float t, float* x, float* y) {
+    float u = 1 - t;
+    float tt = t * t;
+    float uu = u * u;
+
+    *x = uu * x0 + 2 * u * t * x1 + tt * x2;
+    *y = uu * y0 + 2 * u * t * y1 + tt * y2;
+}
+
+// A vehicle counts as gone once it is a full car length past the screen edge
+bool isInsideWorld(int index) {
+    return vehicles.x[index] >= -VEHICLE_LENGTH && vehicles.x[index] <= WINDOW_WIDTH + VEHICLE_LENGTH &&
+           vehicles.y[index] >= -VEHICLE_LENGTH && vehicles.y[index] <= WINDOW_HEIGHT + VEHICLE_LENGTH;
+}
+
+// Vehicles of one lane and sublane list, stepped by one worker, and the
+// ones that need the shared lane lists, queues or free-list afterwards
+typedef struct {
+    int index;
+    bool laneChanged; // already unlinked from its old list
+} VehicleHandoff;
+
+typedef struct {
+    int moved;
+    VehicleHandoff* handoffs;
+    int handoffCount;
+    int handoffCapacity;
+} LanePartition;
+
+#define NUM_PARTITIONS (NUM_LANES * 3)
+static LanePartition partitions[NUM_PARTITIONS];
+
+// Worker pool for the vehicle step; the thread calling updateVehicles() is
+// worker 0, so one worker means no extra threads
+static int workerCount = 1;
+static pthread_barrier_t stepStart;
+static pthread_barrier_t stepDone;
+static atomic_int nextPartition;
+static LightPhase stepLights; // lights as read at the start of the step in progress
+
+// Progress along a lane at which its stop line lies; vehicles in the straight
+// sublane stop short of it while their light is red
+static float stopLineProgress(char lane) {
+    switch (lane) {
+        case 'A': return progressAlong('A', WINDOW_WIDTH / 2 - 150, 0);
+        case 'B': return progressAlong('B', WINDOW_WIDTH / 2 + 150, 0);
+        case 'C': return progressAlong('C', 0, WINDOW_HEIGHT / 2 - 150);
+        default:  return progressAlong('D', 0, WINDOW_HEIGHT / 2 + 150);
+    }
+}
+
+// Intelligent Driver Model: acceleration at the given speed with an obstacle
+// gap pixels ahead that is closing at approachRate (INFINITY gap for none)
+static float idmAcceleration(float speed, float gap, float approachRate) {
+    float ratio = speed / IDM_DESIRED_SPEED;
+    float accel = 1.0f - ratio * ratio * ratio * ratio;
+    if (gap < INFINITY) {
+        if (gap <= 0.0f) {
+            return -INFINITY; // overlapping, e.g. spawned on top of each other
+        }
+        float dynamic = speed * IDM_TIME_HEADWAY +
+                        speed * approachRate / (2.0f * sqrtf(IDM_MAX_ACCEL * IDM_COMFORT_DECEL));
+        float desired = IDM_MIN_GAP + (dynamic > 0.0f ? dynamic : 0.0f);
+        accel -= (desired / gap) * (desired / gap);
+    }
+    return IDM_MAX_ACCEL * accel;
+}
+
+// Move a vehicle distance pixels along its route and take on the lane of
+// the segment it ends up on
+static void moveAlongRoute(int i, float distance) {
+    const RouteTable* route = &routeTables[vehicles.route[i]];
+    float s = vehicles.routeDistance[i] + distance;
+    if (s > route->length) {
+        s = route->length;
+    }
+    vehicles.routeDistance[i] = s;
+
+    float position = s / ROUTE_SAMPLE_SPACING;
+    int k = (int)position;
+    if (k >= route->sampleCount - 1) {
+        vehicles.x[i] = route->x[route->sampleCount - 1];
+        vehicles.y[i] = route->y[route->sampleCount - 1];
+    } else {
+        float f = position - k;
+        vehicles.x[i] = route->x[k] + (route->x[k + 1] - route->x[k]) * f;
+        vehicles.y[i] = route->y[k] + (route->y[k + 1] - route->y[k]) * f;
+    }
+
+    int segment = 0;
+    while (segment < route->definition->segmentCount - 1 && s >= route->segmentEnd[segment]) {
+        segment++;
+    }
+    const RouteSegment* on = &route->definition->segments[segment];
+    if (vehicles.lane[i] != on->lane || vehicles.sublane[i] != on->sublane) {
+        vehicles.lane[i] = on->lane;
+        vehicles.sublane[i] = on->sublane;
+        vehicles.info[i].direction = getDirection(on->lane);
+    }
+}
+
+// Uniform grid over the junction box, rebuilt from the positions at the
+// start of every step. Vehicles crossing each other's paths inside the box
+// never share a lane list, so this is how they see each other: a vehicle
+// yields to any vehicle ahead of it on its heading that entered the box
+// before it. That order is strict, so two vehicles never wait for each other.
+#define GRID_CELLS_PER_SIDE ((2 * JUNCTION_HALF_SIZE + JUNCTION_CELL_SIZE - 1) / JUNCTION_CELL_SIZE)
+#define GRID_LEFT (WINDOW_WIDTH / 2 - JUNCTION_HALF_SIZE)
+#define GRID_TOP (WINDOW_HEIGHT / 2 - JUNCTION_HALF_SIZE)
+#define CONFLICT_WIDTH ((VEHICLE_SIZE + VEHICLE_LENGTH) / 2.0f) // sideways distance at which two cars touch
+
+typedef struct {
+    int index;
+    float x;
+    float y;
+    int order;  // when it entered the box, lower goes first
+    char lane;  // lane list it was in; the lane leader covers that one
+    int sublane;
+} GridEntry;
+
+static GridEntry* gridEntries; // sorted by cell
+static GridEntry* gridScratch;
+static int gridCapacity;
+static int gridCellStart[GRID_CELLS_PER_SIDE * GRID_CELLS_PER_SIDE + 1];
+static int junctionEntries; // vehicles that have entered the box so far
+
+static bool insideJunction(float x, float y) {
+    return fabsf(x - WINDOW_WIDTH / 2) < JUNCTION_HALF_SIZE && fabsf(y - WINDOW_HEIGHT / 2) < JUNCTION_HALF_SIZE;
+}
+
+static int gridCell(float position, int origin) {
+    int cell = (int)floorf((position - origin) / JUNCTION_CELL_SIZE);
+    return cell < 0 ? 0 : cell >= GRID_CELLS_PER_SIDE ? GRID_CELLS_PER_SIDE - 1 : cell;
+}
+
+// Collect the vehicles inside the box and bucket them by cell; the caller
+// holds vehicleMutex and no worker is stepping
+static void buildJunctionGrid() {
+    int count = 0;
+    for (int p = 0; p < NUM_PARTITIONS; p++) {
+        for (int i = laneLists[p / 3][p % 3].front; i != -1; i = vehicles.laneBehind[i]) {
+            if (!insideJunction(vehicles.x[i], vehicles.y[i])) continue;
+            if (vehicles.junctionOrder[i] == 0) {
+                vehicles.junctionOrder[i] = ++junctionEntries;
+            }
+            if (count == gridCapacity) {
+                int capacity = gridCapacity ? gridCapacity * 2 : 64;
+                GridEntry* entries = realloc(gridEntries, capacity * sizeof(GridEntry));
+                GridEntry* scratch = entries ? realloc(gridScratch, capacity * sizeof(GridEntry)) : NULL;
+                if (entries) gridEntries = entries;
+                if (scratch == NULL) {
+                    perror("Failed to grow junction grid");
+                    exit(1);
+                }
+                gridScratch = scratch;
+                gridCapacity = capacity;
+            }
+            gridScratch[count++] = (GridEntry){
+                i, vehicles.x[i], vehicles.y[i], vehicles.junctionOrder[i], 'A' + p / 3, p % 3 + 1
+            };
+        }
+    }
+
+    // Counting sort by cell
+    int cells = GRID_CELLS_PER_SIDE * GRID_CELLS_PER_SIDE;
+    memset(gridCellStart, 0, sizeof(gridCellStart));
+    for (int n = 0; n < count; n++) {
+        int cell = gridCell(gridScratch[n].y, GRID_TOP) * GRID_CELLS_PER_SIDE + gridCell(gridScratch[n].x, GRID_LEFT);
+        gridCellStart[cell + 1]++;
+    }
+    for (int c = 0; c < cells; c++) {
+        gridCellStart[c + 1] += gridCellStart[c];
+    }
+    int fill[GRID_CELLS_PER_SIDE * GRID_CELLS_PER_SIDE];
+    memcpy(fill, gridCellStart, sizeof(fill));
+    for (int n = 0; n < count; n++) {
+        int cell = gridCell(gridScratch[n].y, GRID_TOP) * GRID_CELLS_PER_SIDE + gridCell(gridScratch[n].x, GRID_LEFT);
+        gridEntries[fill[cell]++] = gridScratch[n];
+    }
+}
+
+// Direction of travel at a vehicle's place on its route
+static void routeHeading(int i, float* hx, float* hy) {
+    const RouteTable* route = &routeTables[vehicles.route[i]];
+    int k = (int)(vehicles.routeDistance[i] / ROUTE_SAMPLE_SPACING);
+    if (k > route->sampleCount - 2) k = route->sampleCount - 2;
+    float dx = route->x[k + 1] - route->x[k];
+    float dy = route->y[k + 1] - route->y[k];
+    float length = hypotf(dx, dy);
+    *hx = length > 0.0f ? dx / length : 0.0f;
+    *hy = length > 0.0f ? dy / length : 0.0f;
+}
+
+// Gap to the nearest crossing vehicle with right of way within braking
+// reach, INFINITY if there is none. Only reads the grid and the vehicle's
+// own state, so workers can call it in parallel.
+static float junctionConflictGap(int i, float speed) {
+    float reach = VEHICLE_LENGTH + IDM_MIN_GAP + speed * speed / (2.0f * IDM_COMFORT_DECEL);
+    float x = vehicles.x[i], y = vehicles.y[i];
+    float range = JUNCTION_HALF_SIZE + reach + CONFLICT_WIDTH;
+    if (gridCellStart[GRID_CELLS_PER_SIDE * GRID_CELLS_PER_SIDE] == 0 ||
+        fabsf(x - WINDOW_WIDTH / 2) > range || fabsf(y - WINDOW_HEIGHT / 2) > range) {
+        return INFINITY; // box empty or out of reach
+    }
+    float hx, hy;
+    routeHeading(i, &hx, &hy);
+    float endX = x + hx * reach, endY = y + hy * reach;
+
+    // Cells touched by the stretch of road ahead, if any are in the box
+    float minX = fminf(x, endX) - CONFLICT_WIDTH, maxX = fmaxf(x, endX) + CONFLICT_WIDTH;
+    float minY = fminf(y, endY) - CONFLICT_WIDTH, maxY = fmaxf(y, endY) + CONFLICT_WIDTH;
+    if (maxX < GRID_LEFT || minX > GRID_LEFT + 2 * JUNCTION_HALF_SIZE ||
+        maxY < GRID_TOP || minY > GRID_TOP + 2 * JUNCTION_HALF_SIZE) {
+        return INFINITY;
+    }
+    int order = vehicles.junctionOrder[i] ? vehicles.junctionOrder[i] : INT_MAX;
+    char lane = vehicles.lane[i];
+    int sublane = vehicles.sublane[i];
+    float nearest = INFINITY;
+    for (int cy = gridCell(minY, GRID_TOP); cy <= gridCell(maxY, GRID_TOP); cy++) {
+        for (int cx = gridCell(minX, GRID_LEFT); cx <= gridCell(maxX, GRID_LEFT); cx++) {
+            int cell = cy * GRID_CELLS_PER_SIDE + cx;
+            for (int n = gridCellStart[cell]; n < gridCellStart[cell + 1]; n++) {
+                const GridEntry* other = &gridEntries[n];
+                if (other->order >= order || (other->lane == lane && other->sublane == sublane)) {
+                    continue;
+                }
+                float dx = other->x - x, dy = other->y - y;
+                float along = dx * hx + dy * hy;
+                float across = fabsf(dx * hy - dy * hx);
+                if (along > 0.0f && along < reach && across < CONFLICT_WIDTH && along < nearest) {
+                    nearest = along;
+                }
+            }
+        }
+    }
+    return nearest - VEHICLE_LENGTH;
+}
+
+// Advance one vehicle by dt seconds. Its acceleration follows the vehicle
+// ahead as that vehicle was before this tick, so the result does not depend
+// on the order vehicles are stepped in. Speed is integrated once per step
+// and the distance covered is looked up on the vehicle's route table.
+// Returns false if the vehicle stood still.
+static bool stepVehicle(int i, bool hasAhead, float aheadProgress, float aheadSpeed, float dt) {
+    float speed = vehicles.speed[i];
+    float progress = laneProgress(i);
+    float accel = idmAcceleration(speed, INFINITY, 0.0f);
+
+    // The lane list is ordered, so the vehicle ahead is the neighbouring
+    // entry; cars spawned on top of each other leave in list order
+    if (hasAhead) {
+        float gap = aheadProgress - progress - VEHICLE_LENGTH;
+        float following = idmAcceleration(speed, gap, speed - aheadSpeed);
+        if (following < accel) accel = following;
+    }
+    // A red light is a standing obstacle at the stop line
+    char lane = vehicles.lane[i];
+    if (vehicles.sublane[i] == 2 && !LIGHT_GREEN(stepLights, lane - 'A')) {
+        float stopLine = stopLineProgress(lane);
+        if (progress < stopLine) {
+            float stopping = idmAcceleration(speed, stopLine - progress, speed);
+            if (stopping < accel) accel = stopping;
+        }
+    }
+    // Crossing traffic in the junction that got there first
+    float conflictGap = junctionConflictGap(i, speed);
+    if (conflictGap < INFINITY) {
+        float yielding = idmAcceleration(speed, conflictGap, speed);
+        if (yielding < accel) accel = yielding;
+    }
+
+    // Ballistic update that never reverses: stop inside the step if needed
+    float newSpeed = speed + accel * dt;
+    float distance;
+    if (newSpeed <= 0.0f) {
+        distance = accel < 0.0f && isfinite(accel) ? -speed * speed / (2.0f * accel) : 0.0f;
+        newSpeed = 0.0f;
+    } else {
+        distance = (speed + newSpeed) * 0.5f * dt;
+    }
+    if (newSpeed < IDM_STOP_SPEED && speed < IDM_STOP_SPEED) {
+        newSpeed = 0.0f; // don't creep towards the car ahead forever
+        distance = 0.0f;
+    }
+    vehicles.speed[i] = newSpeed;
+    if ((speed < IDM_STOP_SPEED) != (newSpeed < IDM_STOP_SPEED)) {
+        // Counted against the list the vehicle is in until the hand-off
+        atomic_fetch_add_explicit(&waitingCount[lane - 'A'][vehicles.sublane[i] - 1],
+                                  newSpeed < IDM_STOP_SPEED ? 1 : -1, memory_order_relaxed);
+    }
+    if (distance <= 0.0f) {
+        return false;
+    }
+
+    moveAlongRoute(i, distance);
+    return true;
+}
+
+static void addHandoff(LanePartition* partition, int index, bool laneChanged) {
+    if (partition->handoffCount == partition->handoffCapacity) {
+        int capacity = partition->handoffCapacity ? partition->handoffCapacity * 2 : 64;
+        VehicleHandoff* grown = realloc(partition->handoffs, capacity * sizeof(VehicleHandoff));
+        if (grown == NULL) {
+            perror("Failed to grow lane partition");
+            exit(1);
+        }
+        partition->handoffs = grown;
+        partition->handoffCapacity = capacity;
+    }
+    partition->handoffs[partition->handoffCount++] = (VehicleHandoff){index, laneChanged};
+}
+
+// Step every vehicle of one lane list. Only that list's links and its own
+// vehicles are written, so partitions can run on different threads.
+static void stepPartition(int p, float dt) {
+    LanePartition* partition = &partitions[p];
+    LaneList* list = &laneLists[p / 3][p % 3];
+    char lane = 'A' + p / 3;
+    int sublane = p % 3 + 1;
+    partition->moved = 0;
+    partition->handoffCount = 0;
+
+    // Front to back, so the vehicle stepped just before is the one ahead;
+    // its progress and speed are carried over from before it moved. Vehicles that
+    // changed lane are unlinked here and joined to their new list later.
+    bool hasAhead = false;
+    float aheadProgress = 0.0f;
+    float aheadSpeed = 0.0f;
+    for (int i = list->front, behind; i != -1; i = behind) {
+        behind = vehicles.laneBehind[i];
+        float progress = laneProgress(i);
+        float speed = vehicles.speed[i];
+        if (stepVehicle(i, hasAhead, aheadProgress, aheadSpeed, dt) && isInsideWorld(i)) {
+            partition->moved++;
+        }
+        if (vehicles.lane[i] != lane || vehicles.sublane[i] != sublane) {
+            laneListRemove(i, lane, sublane);
+            addHandoff(partition, i, true);
+        }
+        hasAhead = true;
+        aheadProgress = progress;
+        aheadSpeed = speed;
+    }
+    // Keep the rest in order and note the ones whose queue or slot changes
+    for (int i = list->front, behind; i != -1; i = behind) {
+        behind = vehicles.laneBehind[i];
+        laneListRestoreOrder(i);
+        if (detectionZoneLane(i) != vehicles.queuedLane[i] || !isInsideWorld(i)) {
+            addHandoff(partition, i, false);
+        }
+    }
+}
+
+static float stepSeconds; // dt of the step in progress, for the workers
+
+static void stepPartitions() {
+    int p;
+    while ((p = atomic_fetch_add(&nextPartition, 1)) < NUM_PARTITIONS) {
+        stepPartition(p, stepSeconds);
+    }
+}
+
+static void* vehicleWorker(void* arg) {
+    while (1) {
+        pthread_barrier_wait(&stepStart);
+        stepPartitions();
+        pthread_barrier_wait(&stepDone);
+    }
+    return NULL;
+}
+
+// Step vehicles on count threads from now on; call once before the first tick
+void initVehicleWorkers(int count) {
+    if (count <= 1 || workerCount > 1) return;
+    pthread_barrier_init(&stepStart, NULL, count);
+    pthread_barrier_init(&stepDone, NULL, count);
+    for (int i = 1; i < count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, vehicleWorker, NULL) != 0) {
+            perror("Failed to create vehicle worker");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+    workerCount = count;
+}
+
+// Advance every vehicle by dt seconds and retire the ones that left the
+// screen; returns how many on-screen vehicles moved. The lane lists are
+// stepped in parallel, then lane changes, queues and retirements are applied
+// in list order on this thread, so the result is the same for any worker
+// count. Each vehicle gets one ballistic update per call, so long steps are
+// only first-order accurate. dt is not split into substeps: that costs the
+// speed of long steps, and most of their drift comes from arrivals and light
+// changes being taken between steps, which substeps here would not fix.
+int updateVehicles(double dt) {
+    int moved = 0;
+    pthread_mutex_lock(&vehicleMutex);
+    stepSeconds = (float)dt;
+    stepLights = readLightPhase(); // a phase change mid-step applies from the next one
+    buildJunctionGrid();
+    atomic_store(&nextPartition, 0);
+    if (workerCount > 1) {
+        pthread_barrier_wait(&stepStart);
+    }
+    stepPartitions();
+    if (workerCount > 1) {
+        pthread_barrier_wait(&stepDone);
+    }
+
+    for (int p = 0; p < NUM_PARTITIONS; p++) {
+        LanePartition* partition = &partitions[p];
+        moved += partition->moved;
+        for (int n = 0; n < partition->handoffCount; n++) {
+            int i = partition->handoffs[n].index;
+            if (partition->handoffs[n].laneChanged) {
+                laneListInsert(i);
+            }
+            updateVehicleQueue(i);
+            if (!isInsideWorld(i)) {
+                retireVehicle(i); // drove off the screen
+            }
+        }
+    }
+    pthread_mutex_unlock(&vehicleMutex);
+    return moved;
+}
+
+// Move the vehicles by one tick and advance the simulated clock to match
+void simulationTick() {
+    drainSpawnRequests();
+    updateVehicles(SIM_TICK_SECONDS);
+    simClockAdvance(&simClock, SIM_TICK_SECONDS);
+    publishSnapshot(); // stamped with the time the new positions belong to
+}
+
+// Copy the renderer's view of the world into the publisher's slot and make
+// it the latest snapshot
+void publishSnapshot() {
+    WorldSnapshot* snapshot = &snapshots[publishSlot];
+
+    pthread_mutex_lock(&vehicleMutex);
+    if (snapshot->vehicleCapacity < simStats.activeVehicles) {
+        int capacity = simStats.activeVehicles * 2;
+        SnapshotVehicle* grown = realloc(snapshot->vehicles, capacity * sizeof(SnapshotVehicle));
+        if (grown == NULL) {
+            perror("Failed to grow world snapshot");
+            exit(1);
+        }
+        snapshot->vehicles = grown;
+        snapshot->vehicleCapacity = capacity;
+    }
+    int count = 0;
+    for (int i = 0; i < vehicles.capacity; i++) {
+        if (!vehicles.active[i]) continue;
+        snapshot->vehicles[count++] = (SnapshotVehicle){
+            vehicles.x[i], vehicles.y[i], vehicles.lane[i], vehicles.info[i].color,
+            i, vehicles.info[i].serial
+        };
+    }
+    LightPhase lights = readLightPhase();
+    for (int i = 0; i < NUM_LANES; i++) {
+        snapshot->green[i] = LIGHT_GREEN(lights, i);
+        snapshot->queueSizes[i] = laneQueues[i].size;
+    }
+    pthread_mutex_unlock(&vehicleMutex);
+
+    snapshot->vehicleCount = count;
+    snapshot->tick = ++snapshotTick;
+    snapshot->time = simClockNow(&simClock);
+    publishSlot = atomic_exchange(&sharedSnapshot, publishSlot | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+}
+
+// Latest published snapshot; it stays valid until the next call
+const WorldSnapshot* latestSnapshot() {
+    if (atomic_load(&sharedSnapshot) & SNAPSHOT_FRESH) {
+        readSlot = atomic_exchange(&sharedSnapshot, readSlot) & ~SNAPSHOT_FRESH;
+    }
+    return &snapshots[readSlot];
+}
+
+// Read "id:lane:sublane[:choice]" lines and spawn the whole file as one
+// batch. Returns how many lines were read, or -1 if the file can't be opened.
+int spawnVehiclesFromFile(const char* path, bool verbose) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    SpawnRequest* requests = NULL;
+    int count = 0;
+    int capacity = 0;
+    int dropped = 0; // lines read after the request array could not grow
+    char line[24];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = 0;
+        char* vehicleNumber = strtok(line, ":");
+        char* lane = strtok(NULL, ":");
+        char* sublane = strtok(NULL, ":");
+        char* choice = strtok(NULL, ":");
+
+        if (vehicleNumber && lane && sublane) {
+            if (verbose) {
+                printf("Read vehicle: %s, Lane: %s, Sublane: %s\n", vehicleNumber, lane, sublane);
+            }
+            if (dropped == 0 && count == capacity) {
+                int grownCapacity = capacity ? capacity * 2 : 256;
+                SpawnRequest* grown = realloc(requests, grownCapacity * sizeof(SpawnRequest));
+                if (grown != NULL) {
+                    requests = grown;
+                    capacity = grownCapacity;
+                }
+            }
+            if (count == capacity) {
+                dropped++; // spawn what was read so far, count the rest
+                continue;
+            }
+            SpawnRequest* request = &requests[count++];
+            snprintf(request->id, sizeof(request->id), "%s", vehicleNumber);
+            request->lane = lane[0];
+            request->sublane = atoi(sublane);
+            request->choice = choice ? atoi(choice) : -1;
+        }
+    }
+    fclose(file);
+    if (dropped > 0) {
+        fprintf(stderr, "Out of memory reading %s: dropped %d vehicles\n", path, dropped);
+        pthread_mutex_lock(&vehicleMutex);
+        simStats.vehiclesDropped += dropped;
+        pthread_mutex_unlock(&vehicleMutex);
+    }
+    if (count > 0) {
+        spawnVehicleBatch(requests, count, NULL);
+    }
+    free(requests);
+    return count + dropped;
+}
+
+void* readAndParseFile(void* arg) {
+    int participant = simClockRegister(&simClock);
+    printf("Reading vehicle data...\n");
+    while(1) {
+        if (spawnVehiclesFromFile("vehicles.data", true) < 0) {
+            perror("Error opening file");
+        }
+        simClockSleep(&simClock, participant, 1);
+    }
+    return NULL;
+}
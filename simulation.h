@@ -0,0 +1,281 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+// Simulation core: vehicles, traffic lights, lane queues and the controller.
+// Nothing in here depends on SDL so it can be driven by the windowed
+// simulator or by the headless batch runner.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#define WINDOW_WIDTH 1280
+#define WINDOW_HEIGHT 720
+#define ROAD_WIDTH 210
+#define LANE_WIDTH 70
+#define VEHICLE_SIZE 40
+#define VEHICLE_LENGTH 60
+#define INITIAL_VEHICLE_CAPACITY 512 // Starting vehicle pool size; grows on demand
+#define VEHICLE_SPEED 4 // Pixels per SIM_TICK_MS at cruising speed
+#define LEFT_TURN 1
+#define STRAIGHT 2
+#define RIGHT_TURN 3
+#define STOP_DISTANCE 175 // Distance from traffic light where vehicles should stop
+#define INITIAL_QUEUE_CAPACITY 64 // Starting size of each lane queue; grows on demand
+#define NUM_LANES 4 // A, B, C, D lanes
+#define SIM_TICK_MS 16 // Simulated time covered by one updateVehicles() call
+#define SIM_TICK_SECONDS (SIM_TICK_MS / 1000.0)
+#define IDM_DESIRED_SPEED (VEHICLE_SPEED / (float)SIM_TICK_SECONDS) // Cruising speed, pixels per second
+#define IDM_MAX_ACCEL 250.0f     // Pixels per second squared
+#define IDM_COMFORT_DECEL 400.0f // Pixels per second squared
+#define IDM_MIN_GAP 10.0f        // Bumper to bumper gap when standing
+#define IDM_TIME_HEADWAY 0.2f    // Seconds of following distance
+#define IDM_STOP_SPEED 1.0f      // Slower than this counts as standing
+#define JUNCTION_HALF_SIZE 140 // Half the side of the box where crossing vehicles yield
+#define JUNCTION_CELL_SIZE VEHICLE_LENGTH // Side of a conflict grid cell
+#define VEHICLE_SPAWN_INTERVAL_MS 800 // Delay between randomly generated vehicles
+#define SIM_CLOCK_MAX_PARTICIPANTS 8 // Threads that can sleep on the simulated clock
+#define SIM_CLOCK_MAX_LAG 0.25 // Wall seconds a paced clock catches up after a stall
+#define PRIORITY_QUEUE_THRESHOLD 5 // A lane queue longer than this gets priority
+#define SPAWN_RING_SIZE 8192 // Pending spawn requests between two ticks; a power of two
+
+typedef struct {
+    unsigned char r, g, b, a;
+} VehicleColor;
+
+// Per-vehicle metadata that the movement loop never touches
+typedef struct {
+    char id[9];
+    VehicleColor color;
+    int direction;
+    int route_type;
+    char target_lane;
+    int target_sublane;
+    long serial; // spawn number, tells apart vehicles that reuse a slot
+} VehicleInfo;
+
+// Vehicle pool stored as structure-of-arrays: the fields read every tick
+// sit in their own contiguous arrays, so scans stream through memory.
+// The arrays grow together under vehicleMutex; vehicles are referred to by
+// index, never by pointer, so indices stay valid when the arrays move.
+typedef struct {
+    int capacity; // slots allocated in every array
+    float* x;
+    float* y;
+    float* speed; // pixels per second
+    char* lane;
+    unsigned char* sublane;
+    unsigned char* active; // 0 or 1
+    unsigned char* route;  // route through the junction, picked at spawn
+    float* routeDistance;  // pixels travelled along the route
+    int* junctionOrder;    // order of entering the junction box, 0 before that
+    signed char* queuedLane; // lane queue this vehicle is waiting in, -1 if none
+    int* laneAhead;  // next vehicle ahead in the same lane and sublane, -1 if none
+    int* laneBehind; // next vehicle behind, -1 if none
+    VehicleInfo* info;
+} VehiclePool;
+
+// Seeded random stream; each source of randomness owns one
+typedef struct {
+    uint64_t state;
+} SimRandom;
+
+// Arrival handed from a producer thread to the simulation tick
+typedef struct {
+    char id[9];
+    char lane;
+    int sublane;
+    int choice; // turn choice picking the route, -1 to draw one at random
+} SpawnRequest;
+
+// Vehicle state the renderer needs, copied out of the pool
+typedef struct {
+    float x;
+    float y;
+    char lane;
+    VehicleColor color;
+    int slot;    // pool index; snapshots list vehicles in slot order
+    long serial; // same slot and serial in two snapshots is the same vehicle
+} SnapshotVehicle;
+
+// Copy of the world published after each tick, so the renderer can draw
+// without holding vehicleMutex. A published snapshot is never modified.
+// time is the simulated time the snapshot shows, which lets a renderer
+// interpolate between two of them.
+typedef struct {
+    long tick;
+    double time;
+    bool green[4];
+    int queueSizes[NUM_LANES];
+    int vehicleCount;
+    int vehicleCapacity; // entries allocated in vehicles
+    SnapshotVehicle* vehicles;
+} WorldSnapshot;
+
+// Doubly linked list of the vehicles in one lane and sublane
+typedef struct {
+    int front; // furthest along the lane
+    int back;
+} LaneList;
+
+// Light state of every lane packed in one word, published atomically by the
+// controller so the tick and the renderer read it without locking: bit n is
+// set while lane n is green and the bits from LIGHT_VERSION_SHIFT up count
+// phase changes, so two reads with the same word saw the same phase
+typedef uint64_t LightPhase;
+#define LIGHT_VERSION_SHIFT 8
+#define LIGHT_GREEN(phase, lane) ((((phase) >> (lane)) & 1) != 0)
+#define LIGHT_VERSION(phase) ((phase) >> LIGHT_VERSION_SHIFT)
+
+// Queue implementation for traffic management; a ring buffer that doubles
+// when full, so enqueue only fails if memory runs out
+typedef struct {
+    int* vehicleIndices; // Stores indices of vehicles in queue
+    int capacity;
+    int front;
+    int rear;
+    int size;
+} TrafficQueue;
+
+// Timed event for the discrete-event engines; type and data are engine specific
+typedef struct {
+    double time;
+    long sequence; // keeps events scheduled for the same time in FIFO order
+    int type;
+    int data;
+} SimEvent;
+
+typedef struct {
+    SimEvent* events;
+    int size;
+    int capacity;
+    long nextSequence;
+} EventQueue;
+
+// Simulated clock shared by the main loop and the worker threads.
+// Only the main loop advances it; threads sleep on simulated time, and an
+// advance never runs past a sleeping thread's deadline until that thread has
+// done its work, so timing is the same at any time scale. A notified thread
+// wakes at the current instant and the clock waits for it the same way.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    double now;       // simulated seconds since start
+    double timeScale; // 1 = real time, 10 = ten times faster, 0 = unlimited
+    int participantCount;
+    double wakeAt[SIM_CLOCK_MAX_PARTICIPANTS];
+    bool sleeping[SIM_CLOCK_MAX_PARTICIPANTS];
+    bool notified[SIM_CLOCK_MAX_PARTICIPANTS];
+    double paceStart; // wall clock seconds when pacing started
+} SimClock;
+
+// State carried by the advanced controller between two decisions
+typedef struct {
+    int currentServingLane;
+    double lastRotationTime;
+    double normalRotationDuration; // seconds per lane in normal rotation
+    int phaseChanges;           // number of times a lane was given the green light
+    bool verbose;               // print queue sizes and decisions
+} TrafficController;
+
+// Counters reported by the headless runner
+typedef struct {
+    long vehiclesSpawned;
+    long vehiclesDropped; // arrivals rejected: the pool could not grow or the spawn ring was full
+    long vehiclesRetired; // vehicles that drove off the screen
+    int activeVehicles;
+    int peakActiveVehicles;
+} SimStats;
+
+extern VehiclePool vehicles;
+extern TrafficQueue laneQueues[NUM_LANES];
+extern LaneList laneLists[NUM_LANES][3];
+extern pthread_mutex_t vehicleMutex;
+extern SimStats simStats;
+extern SimClock simClock;
+
+// Reproducibility
+#define WORLD_HASH_SEED 0xCBF29CE484222325ULL // FNV-1a offset basis
+unsigned int simRandomNext(SimRandom* rng);
+void seedSimulation(uint64_t seed);
+uint64_t hashWorldState(uint64_t hash);
+
+// Simulated clock
+void simClockInit(SimClock* clock, double timeScale);
+double simClockNow(SimClock* clock);
+int simClockRegister(SimClock* clock);
+bool simClockSleep(SimClock* clock, int participant, double seconds);
+void simClockNotify(SimClock* clock, int participant);
+void simClockAdvance(SimClock* clock, double seconds);
+void simClockPace(SimClock* clock);
+double simClockPacedTime(SimClock* clock);
+double wallClockSeconds();
+
+// Event queue
+void initEventQueue(EventQueue* queue);
+void freeEventQueue(EventQueue* queue);
+void scheduleEvent(EventQueue* queue, double time, int type, int data);
+bool popEvent(EventQueue* queue, SimEvent* event);
+double nextEventTime(const EventQueue* queue);
+
+// Queue
+void initQueue(TrafficQueue* queue);
+bool isQueueEmpty(TrafficQueue* queue);
+bool isQueueFull(TrafficQueue* queue);
+bool enqueue(TrafficQueue* queue, int vehicleIndex);
+int dequeue(TrafficQueue* queue);
+int peek(TrafficQueue* queue);
+bool removeFromQueue(TrafficQueue* queue, int vehicleIndex);
+int detectionZoneLane(int index);
+void updateVehicleQueue(int index);
+
+// Traffic lights
+void initTrafficLights();
+LightPhase readLightPhase();
+void publishLights(unsigned greenMask);
+void countVehiclesPerLane(int laneQueue[], int sublane);
+int laneOccupancy(char lane, int sublane); // safe without vehicleMutex
+int laneWaiting(char lane, int sublane);   // of those, vehicles standing still
+int laneQueueLength(int lane);
+int calculateGreenLightDuration(int vehicleCount);
+void initTrafficController(TrafficController* ctrl, double now);
+double trafficControllerStep(TrafficController* ctrl, double now);
+bool takeControllerWake();
+void* updateTrafficLights(void* arg);
+void* updateTrafficLightsAdvanced(void* arg);
+
+// Vehicles
+int getRouteType(char source_lane, int source_sublane, char target_lane, int target_sublane);
+void getLanePosition(char lane, int sublane, int* x, int* y);
+void initVehicles(int capacity);
+void retireVehicle(int index);
+float laneProgress(int index);
+void laneListInsert(int index);
+void laneListRemove(int index, char lane, int sublane);
+void laneListRestoreOrder(int index);
+int getDirection(char lane);
+int spawnVehicle(const char* id, char lane, int sublane);
+int spawnVehicleBatch(const SpawnRequest* requests, int count, bool* accepted);
+void requestSpawn(const char* id, char lane, int sublane);
+int drainSpawnRequests();
+void spawnRandomVehicle();
+int spawnVehiclesFromFile(const char* path, bool verbose);
+void* generateVehicles(void* arg);
+void* readAndParseFile(void* arg);
+void calculateBezierCurve(float x0, float y0, float x1, float y1, float x2, float y2, float t, float* x, float* y);
+bool isInsideWorld(int index);
+void initVehicleWorkers(int count);
+int updateVehicles(double dt);
+void simulationTick();
+
+// Mesoscopic mode: lane queues and timed events instead of positions
+void initMesoscopic(double headway);
+double mesoNextEventTime();
+void mesoAdvance(double now);
+
+// Snapshots: one publishing thread, one reading thread
+void publishSnapshot();
+const WorldSnapshot* latestSnapshot();
+
+#endif
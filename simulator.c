@@ -8,41 +8,11 @@
 #include <string.h>
 #include <time.h> 
 #include <math.h>
+#include <stdatomic.h>
+#include "simulation.h"
 
-#define WINDOW_WIDTH 1280
 #define MAIN_FONT "DejaVuSans.ttf"
-#define WINDOW_HEIGHT 720
 #define SCALE 1
-#define ROAD_WIDTH 210  
-#define LANE_WIDTH 70   
-#define VEHICLE_SIZE 40
-#define VEHICLE_LENGTH 60  
-#define MAX_VEHICLES 500   
-#define VEHICLE_SPEED 4
-#define LEFT_TURN 1
-#define STRAIGHT 2
-#define RIGHT_TURN 3
-#define STOP_DISTANCE 175 // Distance from traffic light where vehicles should stop
-#define MAX_QUEUE_SIZE 200 // Maximum size for our traffic queues
-#define NUM_LANES 4 // A, B, C, D lanes
-
-typedef struct {
-    char id[9];        
-    int x, y;          
-    char lane;        
-    int sublane;       
-    bool active;
-    int direction;    
-    int route_type;   
-    char target_lane;  
-    int target_sublane; 
-    int choice;
-    SDL_Color color;
-} Vehicle;
-
-Vehicle vehicles[MAX_VEHICLES];
-
-SDL_mutex* vehicleMutex;
 
 
 typedef struct{
@@ -51,683 +21,70 @@ typedef struct{
 } SharedData;
 
 
-
-typedef struct {
-    bool green;
-} TrafficLight;
-
-TrafficLight trafficLights[4];
-
-
-// Queue implementation for traffic management
+// Quads for one frame. Every quad samples the sprite atlas, solid ones a
+// white patch of it, and is tinted by its vertex colour, so the whole
+// frame's vehicles, lights and HUD boxes go out in one SDL_RenderGeometry call.
 typedef struct {
-    int vehicleIndices[MAX_QUEUE_SIZE]; // Stores indices of vehicles in queue
-    int front;
-    int rear;
-    int size;
-} TrafficQueue;
-
-TrafficQueue laneQueues[NUM_LANES];
-
-// Initialize a new queue
-void initQueue(TrafficQueue* queue) {
-    queue->front = 0;
-    queue->rear = -1;
-    queue->size = 0;
-}
-
-void initTrafficLights() {
-    for (int i = 0; i < 4; i++) {
-        trafficLights[i].green = false;
-        initQueue(&laneQueues[i]); // Initialize all lane queues
-    }
-}
-// Check if queue is empty
-bool isQueueEmpty(TrafficQueue* queue) {
-    return queue->size == 0;
-}
-
-// Check if queue is full
-bool isQueueFull(TrafficQueue* queue) {
-    return queue->size == MAX_QUEUE_SIZE;
-}
-
-// Add a vehicle index to the queue
-bool enqueue(TrafficQueue* queue, int vehicleIndex) {
-    if (isQueueFull(queue)) {
-        return false;
-    }
-    
-    queue->rear = (queue->rear + 1) % MAX_QUEUE_SIZE;
-    queue->vehicleIndices[queue->rear] = vehicleIndex;
-    queue->size++;
+    SDL_Vertex* vertices; // four per quad
+    int* indices;         // six per quad
+    int quadCount;
+    int capacity;         // quads
+} QuadBatch;
+
+static QuadBatch frameBatch;
+static SDL_Texture* spriteAtlas;
+static int atlasWidth, atlasHeight;
+static SDL_Rect solidSource; // white patch used for plain rectangles
+
+static bool growBatch(QuadBatch* batch) {
+    int capacity = batch->capacity ? batch->capacity * 2 : 256;
+    SDL_Vertex* vertices = realloc(batch->vertices, capacity * 4 * sizeof(SDL_Vertex));
+    if (!vertices) return false;
+    batch->vertices = vertices;
+    int* indices = realloc(batch->indices, capacity * 6 * sizeof(int));
+    if (!indices) return false;
+    batch->indices = indices;
+    // The index pattern never changes, so it is only written for new quads
+    for (int q = batch->capacity; q < capacity; q++) {
+        int* quad = &indices[q * 6];
+        quad[0] = q * 4; quad[1] = q * 4 + 1; quad[2] = q * 4 + 2;
+        quad[3] = q * 4 + 2; quad[4] = q * 4 + 1; quad[5] = q * 4 + 3;
+    }
+    batch->capacity = capacity;
     return true;
 }
 
-// Remove a vehicle index from the queue
-int dequeue(TrafficQueue* queue) {
-    if (isQueueEmpty(queue)) {
-        return -1; // Error: Empty queue
+// Add a quad showing source (a rectangle of the atlas) at destination;
+// dropped if the batch can't grow, which costs one frame a shape
+static void batchQuad(QuadBatch* batch, const SDL_Rect* destination, const SDL_Rect* source, SDL_Color color) {
+    if (batch->quadCount == batch->capacity && !growBatch(batch)) {
+        return;
     }
-    
-    int vehicleIndex = queue->vehicleIndices[queue->front];
-    queue->front = (queue->front + 1) % MAX_QUEUE_SIZE;
-    queue->size--;
-    return vehicleIndex;
+    float left = destination->x, top = destination->y;
+    float right = left + destination->w, bottom = top + destination->h;
+    float u0 = (float)source->x / atlasWidth, v0 = (float)source->y / atlasHeight;
+    float u1 = (float)(source->x + source->w) / atlasWidth, v1 = (float)(source->y + source->h) / atlasHeight;
+    SDL_Vertex* v = &batch->vertices[batch->quadCount++ * 4];
+    v[0] = (SDL_Vertex){ { left, top }, color, { u0, v0 } };
+    v[1] = (SDL_Vertex){ { right, top }, color, { u1, v0 } };
+    v[2] = (SDL_Vertex){ { left, bottom }, color, { u0, v1 } };
+    v[3] = (SDL_Vertex){ { right, bottom }, color, { u1, v1 } };
 }
 
-// Get front of queue without removing
-int peek(TrafficQueue* queue) {
-    if (isQueueEmpty(queue)) {
-        return -1; // Error: Empty queue
-    }
-    
-    return queue->vehicleIndices[queue->front];
-}
-
-
-
-
-// Count the number of vehicles in each lane
-void countVehiclesPerLane(int laneQueue[], int sublane) {
-    for (int i = 0; i < MAX_VEHICLES; i++) {
-        if (vehicles[i].active && vehicles[i].sublane == 2) {
-            switch (vehicles[i].lane) {
-                case 'A':
-                    laneQueue[0]++;
-                    break;
-                case 'B':
-                    laneQueue[1]++;
-                    break;
-                case 'C':
-                    laneQueue[2]++;
-                    break;
-                case 'D':
-                    laneQueue[3]++;
-                    break;
-            }
-        }
-    }
+static void batchRect(QuadBatch* batch, const SDL_Rect* destination, SDL_Color color) {
+    batchQuad(batch, destination, &solidSource, color);
 }
 
-// Update traffic lights dynamically
-void* updateTrafficLights(void* arg) {
-    while (1) {
-        SDL_LockMutex(vehicleMutex);
-        
-        int laneCounts[4] = {0};
-        
-        // Count vehicles in sublane 2 at intersections A, B, C, and D
-        countVehiclesPerLane(laneCounts, 2);
-
-        // Default priority lane
-        int priorityLane = -1; 
-        for (int i = 0; i < 4; i++) {
-            if (laneCounts[i] >= 3) { 
-                priorityLane = i; // Prioritize lanes with 3+ vehicles in sublane 2
-                break;
-            }
-        }
-
-        // Set all traffic lights for sublane 2 to red
-        for (int i = 0; i < 4; i++) {
-            trafficLights[i].green = false;
-        }
-        if (priorityLane != -1) {
-            trafficLights[priorityLane].green = true; // Enable priority lane for sublane 2
-        }
-
-        SDL_UnlockMutex(vehicleMutex);
-
-        sleep(5); // Give time for vehicles to clear
-    }
-    return NULL;
-}
-
-
-void updateTrafficQueues() {
-    SDL_LockMutex(vehicleMutex);
-    
-    // Clear all queues first (we'll rebuild them every update)
-    for (int i = 0; i < NUM_LANES; i++) {
-        initQueue(&laneQueues[i]);
-    }
-    
-    // For each active vehicle, check if it's approaching an intersection
-    for (int i = 0; i < MAX_VEHICLES; i++) {
-        if (!vehicles[i].active) continue;
-        
-        // Only consider vehicles in sublane 2 (straight lane)
-        if (vehicles[i].sublane != 2) continue;
-        
-        bool isApproachingIntersection = false;
-        int laneIndex = -1;
-        
-        switch (vehicles[i].lane) {
-            case 'A':
-                // Vehicle approaching from left - increase detection range
-                if (vehicles[i].x >= (WINDOW_WIDTH / 2 - STOP_DISTANCE * 3) && 
-                    vehicles[i].x < (WINDOW_WIDTH / 2)) {
-                    isApproachingIntersection = true;
-                    laneIndex = 0;
-                }
-                break;
-                
-            case 'B':
-                // Vehicle approaching from right - increase detection range
-                if (vehicles[i].x <= (WINDOW_WIDTH / 2 + STOP_DISTANCE * 3) && 
-                    vehicles[i].x > (WINDOW_WIDTH / 2)) {
-                    isApproachingIntersection = true;
-                    laneIndex = 1;
-                }
-                break;
-                
-            case 'C':
-                // Vehicle approaching from top - increase detection range
-                if (vehicles[i].y >= (WINDOW_HEIGHT / 2 - STOP_DISTANCE * 3) && 
-                    vehicles[i].y < (WINDOW_HEIGHT / 2)) {
-                    isApproachingIntersection = true;
-                    laneIndex = 2;
-                }
-                break;
-                
-            case 'D':
-                // Vehicle approaching from bottom - increase detection range
-                if (vehicles[i].y <= (WINDOW_HEIGHT / 2 + STOP_DISTANCE * 3) && 
-                    vehicles[i].y > (WINDOW_HEIGHT / 2)) {
-                    isApproachingIntersection = true;
-                    laneIndex = 3;
-                }
-                break;
-        }
-        
-        if (isApproachingIntersection && laneIndex != -1) {
-            enqueue(&laneQueues[laneIndex], i);
-        }
-    }
-    
-    SDL_UnlockMutex(vehicleMutex);
-
-    // Debug: Print queue sizes
-//     printf("Queue sizes after update: A:%d, B:%d, C:%d, D:%d\n", 
-//            laneQueues[0].size, laneQueues[1].size, 
-//            laneQueues[2].size, laneQueues[3].size);
-// 
-}
-
-
-// Helper function to calculate green light duration based on vehicle count
-int calculateGreenLightDuration(int vehicleCount) {
-    // Assume each vehicle takes approximately 2 seconds to clear the intersection
-    // Plus a base time of 3 seconds for the first vehicle
-    int baseTime = 3;
-    int timePerVehicle = 2;
-    
-    return baseTime + (vehicleCount * timePerVehicle);
-}
-
-void* updateTrafficLightsAdvanced(void* arg) {
-    int currentServingLane = -1;
-    time_t greenLightStartTime = 0;
-    int highestPriorityLane = -1;
-    int normalRotationDuration = 5; // 5 seconds per lane in normal rotation
-    time_t lastRotationTime = time(NULL);
-    
-    // All lanes are in sublane 2
-    int allLanes[4] = {0, 1, 2, 3}; // A2, B2, C2, D2
-    int numLanes = 4;
-    int lane_C_index = 2; // Lane C2 has special priority
-    
-    while (1) {
-        // Update our understanding of the traffic queues
-        updateTrafficQueues();
-        
-        // Log queue sizes for debugging
-        printf("Queue sizes: A2:%d, B2:%d, C2:%d, D2:%d\n", 
-               laneQueues[0].size, laneQueues[1].size, 
-               laneQueues[2].size, laneQueues[3].size);
-        
-        // Lock mutex before modifying traffic light states
-        SDL_LockMutex(vehicleMutex);
-        
-        // Check for priority conditions
-        bool anyHighPriority = false;
-        highestPriorityLane = -1;
-        
-        // First check if C2 has more than 5 vehicles - it gets absolute priority
-        if (laneQueues[lane_C_index].size > 5) {
-            highestPriorityLane = lane_C_index;
-            anyHighPriority = true;
-            printf("Lane C2 has highest priority with %d vehicles\n", laneQueues[lane_C_index].size);
-        }
-        // If C2 doesn't have priority, check other lanes
-        else {
-            int maxVehicles = 5; // Threshold for high priority
-            
-            // Find lane with most vehicles (above threshold)
-            for (int i = 0; i < numLanes; i++) {
-                // Skip C2 as we already checked it
-                if (i == lane_C_index) continue;
-                
-                if (laneQueues[i].size > maxVehicles) {
-                    maxVehicles = laneQueues[i].size;
-                    highestPriorityLane = i;
-                    anyHighPriority = true;
-                }
-            }
-            
-            if (anyHighPriority) {
-                printf("Lane %c2 has priority with %d vehicles\n", 
-                       'A' + highestPriorityLane, laneQueues[highestPriorityLane].size);
-            }
-        }
-        
-        // Handle high priority mode
-        if (anyHighPriority) {
-            // Set all lights to red
-            for (int i = 0; i < numLanes; i++) {
-                trafficLights[i].green = false;
-            }
-            
-            // Give green light to priority lane
-            trafficLights[highestPriorityLane].green = true;
-            currentServingLane = highestPriorityLane;
-            
-            // Reset normal rotation timing
-            lastRotationTime = time(NULL);
-            
-            printf("HIGH PRIORITY MODE: Lane %c2 gets green light\n", 'A' + highestPriorityLane);
-        }
-        // Handle normal mode (no high priority lanes)
-        else {
-            time_t currentTime = time(NULL);
-            
-            // Check if current lane's green light duration is over or if we need to select a lane
-            if (currentServingLane == -1 || 
-                currentTime - lastRotationTime >= normalRotationDuration ||
-                laneQueues[currentServingLane].size == 0) {
-                
-                // Set all lights to red first
-                for (int i = 0; i < numLanes; i++) {
-                    trafficLights[i].green = false;
-                }
-                
-                // Find lanes with vehicles waiting
-                int lanesWithVehicles[numLanes];
-                int numLanesWithVehicles = 0;
-                
-                for (int i = 0; i < numLanes; i++) {
-                    if (laneQueues[i].size > 0) {
-                        lanesWithVehicles[numLanesWithVehicles++] = i;
-                    }
-                }
-                
-                // If there are lanes with vehicles
-                if (numLanesWithVehicles > 0) {
-                    // Find lane with most waiting vehicles
-                    int maxWaitingLane = lanesWithVehicles[0];
-                    int maxWaitingCount = laneQueues[maxWaitingLane].size;
-                    
-                    for (int i = 1; i < numLanesWithVehicles; i++) {
-                        int laneIndex = lanesWithVehicles[i];
-                        if (laneQueues[laneIndex].size > maxWaitingCount) {
-                            maxWaitingCount = laneQueues[laneIndex].size;
-                            maxWaitingLane = laneIndex;
-                        }
-                    }
-                    
-                    // Set the selected lane to green
-                    trafficLights[maxWaitingLane].green = true;
-                    currentServingLane = maxWaitingLane;
-                    lastRotationTime = currentTime;
-                    
-                    printf("NORMAL MODE: Serving lane %c2 with %d vehicles (highest count)\n", 
-                           'A' + maxWaitingLane, laneQueues[maxWaitingLane].size);
-                } else {
-                    // No vehicles waiting in any lane
-                    currentServingLane = -1;
-                    printf("No vehicles waiting in any lane\n");
-                }
-            }
-        }
-        
-        SDL_UnlockMutex(vehicleMutex);
-        
-        // Check every second
-        sleep(1);
-    }
-    
-    return NULL;
-}
-
-// Function to determine route type based on source and target lanes
-int getRouteType(char source_lane, int source_sublane, char target_lane, int target_sublane) {
-    if (source_lane == 'A') {
-        if (source_sublane == 1 && target_lane == 'C') return LEFT_TURN;
-        if (source_sublane == 2 && target_lane == 'B') return STRAIGHT;
-        if (source_sublane == 3 && target_lane == 'D') return RIGHT_TURN;
-    }
-    // Add similar logic for other lanes
-    // For lane B
-    if (source_lane == 'B') {
-        if (source_sublane == 1 && target_lane == 'D') return LEFT_TURN;
-        if (source_sublane == 2 && target_lane == 'A') return STRAIGHT;
-        if (source_sublane == 3 && target_lane == 'C') return RIGHT_TURN;
-    }
-    // For lane C
-    if (source_lane == 'C') {
-        if (source_sublane == 1 && target_lane == 'B') return LEFT_TURN;
-        if (source_sublane == 2 && target_lane == 'D') return STRAIGHT;
-        if (source_sublane == 3 && target_lane == 'A') return RIGHT_TURN;
-    }
-    // For lane D
-    if (source_lane == 'D') {
-        if (source_sublane == 1 && target_lane == 'A') return LEFT_TURN;
-        if (source_sublane == 2 && target_lane == 'C') return STRAIGHT;
-        if (source_sublane == 3 && target_lane == 'B') return RIGHT_TURN;
-    }
-    return STRAIGHT; // Default case
-}
-
-
-// Convert lane letter and number to screen coordinates
-void getLanePosition(char lane, int sublane, int* x, int* y) {
-    int center_x = WINDOW_WIDTH / 2;
-    int center_y = WINDOW_HEIGHT / 2;
-
-    switch (lane) {
-        case 'A': // Left side lanes (moving right)
-            *x = 0;  // Start from the left
-            *y = center_y - ROAD_WIDTH / 2 + (sublane - 1) * LANE_WIDTH + LANE_WIDTH / 2; // Centered
-            break;
-
-        case 'B': // Right side lanes (moving left)
-            *x = WINDOW_WIDTH; // Start from the right
-            *y = center_y + ROAD_WIDTH / 2 - (sublane - 1) * LANE_WIDTH - LANE_WIDTH / 2; // Centered
-            break;
-
-        case 'C': // Top side lanes (moving down)
-            *x = center_x - ROAD_WIDTH / 2 + (sublane - 1) * LANE_WIDTH + LANE_WIDTH / 2; // Centered
-            *y = 0; // Start from the top
-            break;
-
-        case 'D': // Bottom side lanes (moving up)
-            *x = center_x + ROAD_WIDTH / 2 - (sublane - 1) * LANE_WIDTH - LANE_WIDTH / 2; // Centered
-            *y = WINDOW_HEIGHT; // Start from the bottom
-            break;
-    }
-}
-
-void initVehicles() {
-    for (int i = 0; i < MAX_VEHICLES; i++) {
-        vehicles[i].active = false;
-    }
-}
-
-int getDirection(char lane) {
-    return (lane == 'A' || lane == 'C') ? 1 : -1;
-}
-
-void spawnVehicle(const char* id, char lane, int sublane) {
-    // Prevent spawning in Lane A, Sublane 3
-    if (lane == 'A' && sublane == 3) {
-        return; // Skip this vehicle
-    }
-
-    SDL_LockMutex(vehicleMutex);
-    for (int i = 0; i < MAX_VEHICLES; i++) {
-        if (!vehicles[i].active) {
-            vehicles[i].active = true;
-            snprintf(vehicles[i].id, 9, "%s", id);
-            vehicles[i].lane = lane;
-            vehicles[i].sublane = sublane;
-            vehicles[i].direction = (lane == 'A' || lane == 'C') ? 1 : -1;
-            getLanePosition(lane, sublane, &vehicles[i].x, &vehicles[i].y);
-
-            // Initialize the color attribute
-            vehicles[i].color = (SDL_Color){rand() % 256, rand() % 256, rand() % 256, 255};
-            vehicles[i].choice = rand() % 2;
-
-
-            // printf("Spawned Vehicle: %s at lane %c, sublane %d\n", vehicles[i].id, lane, sublane);
-            break;
-        }
-    }
-    SDL_UnlockMutex(vehicleMutex);
-}
-
-void* generateVehicles(void* arg) {
-    srand(time(NULL));
-    char lanes[] = {'A', 'B', 'C', 'D'};
-
-    while (1) {
-        int laneIndex = rand() % 4;
-        int sublane = (rand() % 3) + 1;
-
-
-        // Prevent spawning in `A3` and `D1`
-        if ((lanes[laneIndex] == 'A' && sublane == 3) ||(lanes[laneIndex] == 'B' && sublane == 3) || (lanes[laneIndex] == 'D' && sublane == 1) || (lanes[laneIndex] == 'C' && sublane == 1)) {
-            continue; // Skip this iteration
-        }
-
-        char vehicleID[9];
-        snprintf(vehicleID, 9, "V%03d", rand() % 1000);
-
-        spawnVehicle(vehicleID, lanes[laneIndex], sublane);
-        SDL_Delay(800);
-    }
-    return NULL;
-}
-
-//for curve turn from A2 to C3
-void calculateBezierCurve(int x0, int y0, int x1, int y1, int x2, int y2, float t, int* x, int* y) {
-    float u = 1 - t;
-    float tt = t * t;
-    float uu = u * u;
-
-    *x = uu * x0 + 2 * u * t * x1 + tt * x2;
-    *y = uu * y0 + 2 * u * t * y1 + tt * y2;
-}
-
-void updateVehicles() {
-    SDL_LockMutex(vehicleMutex);
-    for (int i = 0; i < MAX_VEHICLES; i++) {
-        if (!vehicles[i].active) continue;
-
-        bool canMove = true;
-
-        // Check if there is a vehicle ahead in the same lane and sublane
-        for (int j = 0; j < MAX_VEHICLES; j++) {
-            if (i != j && vehicles[j].active && vehicles[j].lane == vehicles[i].lane && vehicles[j].sublane == vehicles[i].sublane) {
-                if (vehicles[i].lane == 'A' && vehicles[i].x < vehicles[j].x && vehicles[j].x - vehicles[i].x < VEHICLE_LENGTH + 10) {
-                    canMove = false;
-                    break;
-                }
-                if (vehicles[i].lane == 'B' && vehicles[i].x > vehicles[j].x && vehicles[i].x - vehicles[j].x < VEHICLE_LENGTH + 10) {
-                    canMove = false;
-                    break;
-                }
-                if (vehicles[i].lane == 'C' && vehicles[i].y < vehicles[j].y && vehicles[j].y - vehicles[i].y < VEHICLE_LENGTH + 10) {
-                    canMove = false;
-                    break;
-                }
-                if (vehicles[i].lane == 'D' && vehicles[i].y > vehicles[j].y && vehicles[i].y - vehicles[j].y < VEHICLE_LENGTH + 10) {
-                    canMove = false;
-                    break;
-                }
-            }
-        }
-
-        if (!canMove) continue;
-
-        switch (vehicles[i].lane) {
-            case 'A': 
-                if (vehicles[i].sublane == 2 && !trafficLights[0].green && vehicles[i].x >= (WINDOW_WIDTH / 2 - STOP_DISTANCE) && vehicles[i].x < (WINDOW_WIDTH / 2) - 150) {
-                    continue; // Stop if light is red and vehicle is close enough
-                }
-                vehicles[i].x += VEHICLE_SPEED; // Move right
-
-                if (vehicles[i].sublane == 2 && vehicles[i].x >= WINDOW_WIDTH / 2 - 75) {
-                    if (vehicles[i].choice == 0){
-                        vehicles[i].y -=  VEHICLE_SPEED;  // Move smoothly up or down
-                        if (vehicles[i].y <= WINDOW_HEIGHT / 2 - 72 ) {
-                            vehicles[i].lane = 'A'; // Change the lane to either C3 or A1
-                            vehicles[i].sublane =  1;
-                        }
-                    }
-                    else{
-                        // Calculate the Bezier curve points for the turn
-                        int x, y;
-                        float t = (float)(vehicles[i].x - (WINDOW_WIDTH / 2 - 75)) / 150.0f;
-                        // Adjust control points to be slightly above the turn
-                        calculateBezierCurve(WINDOW_WIDTH / 2 - 75, vehicles[i].y, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2 - 20, WINDOW_WIDTH / 2 + 75, WINDOW_HEIGHT / 2 + 150, t, &x, &y);
-                        vehicles[i].x = x;
-                        vehicles[i].y = y;
-
-                        if (t >= 1.0f) {
-                            vehicles[i].lane = 'C'; // Change the lane to C3
-                            vehicles[i].sublane = 3;
-                        }
-                    }
-                }
-                // **A1 should turn left into D1 smoothly**
-                if (vehicles[i].sublane == 1 && vehicles[i].x <= WINDOW_WIDTH / 2 - 50 && vehicles[i].x >= WINDOW_WIDTH / 2 - 75) {
-                    // printf("Turning left: Vehicle %s from A1 to D1\n", vehicles[i].id);
-                    
-                    // Start moving upward instead of continuing right
-                    vehicles[i].y -= VEHICLE_SPEED; 
-                    
-                    // If vehicle has reached the middle, switch lanes
-                    if (vehicles[i].y <= WINDOW_HEIGHT / 2 - 75 ) {
-                        vehicles[i].lane = 'D';
-                        vehicles[i].sublane = 1;
-                        vehicles[i].direction = 1; // Move down in D1
-                    }
-                }
-                break;
-
-            case 'B': 
-                if (vehicles[i].sublane == 2 && !trafficLights[1].green && vehicles[i].x <= (WINDOW_WIDTH / 2 + STOP_DISTANCE) && vehicles[i].x > (WINDOW_WIDTH / 2) + 150) {
-                    continue; // Stop if light is red and vehicle is close enough
-                }
-                vehicles[i].x -= VEHICLE_SPEED; // Move left
-                
-                if (vehicles[i].sublane == 2 && vehicles[i].x <= WINDOW_WIDTH / 2 ) {
-                    if (vehicles[i].choice == 0){
-                        vehicles[i].y += VEHICLE_SPEED; // Move smoothly up or down
-                        if (vehicles[i].y <= WINDOW_HEIGHT / 2 - 75 || vehicles[i].y >= WINDOW_HEIGHT / 2 + 75) {
-                            vehicles[i].lane = 'B'; // Change the lane to either B3 or D1
-                            vehicles[i].sublane = 3;
-                        }
-                 }
-                    else{
-                        vehicles[i].y -=  VEHICLE_SPEED;  // Move smoothly up or down
-                        if (vehicles[i].y <= WINDOW_HEIGHT / 2 - 75 ) {
-                            vehicles[i].lane = 'D'; // Change the lane to either C3 or A1
-                            vehicles[i].sublane =  1;
-                        }
-                    }
-                }
-                // **B1 should turn left into C1 smoothly**
-                if (vehicles[i].sublane == 1 && vehicles[i].x <= WINDOW_WIDTH / 2 + 75) {
-                    // printf("Turning left: Vehicle %s from B1 to C1\n", vehicles[i].id);
-                    
-                    // Start moving downward instead of continuing left
-                    vehicles[i].y += VEHICLE_SPEED;                     
-
-                    // If vehicle has reached the middle, switch lanes
-                    if (vehicles[i].y >= WINDOW_HEIGHT / 2) {
-                        vehicles[i].lane = 'C';
-                        vehicles[i].sublane = 1;
-                        vehicles[i].direction = 1; // Move down in C1
-                    }
-                }
-                break;
-
-            case 'C': 
-                if (vehicles[i].sublane == 2 && !trafficLights[2].green && vehicles[i].y >= (WINDOW_HEIGHT / 2 - STOP_DISTANCE) && vehicles[i].y < (WINDOW_HEIGHT / 2) - 150) {
-                    continue; // Stop if light is red and vehicle is close enough
-                }
-                vehicles[i].y += VEHICLE_SPEED; // Move down
-
-                if (vehicles[i].sublane == 2 && vehicles[i].y >= WINDOW_HEIGHT / 2  ) {
-                        if(vehicles[i].choice == 0){
-                            vehicles[i].x -=  VEHICLE_SPEED; // Move smoothly left 
-                            if (vehicles[i].x <= WINDOW_WIDTH / 2 - 75) {
-                                vehicles[i].lane = 'B'; // Change the lane to either C3 or B3
-                                vehicles[i].sublane = 3;
-                            }
-                    }
-                    else{
-                    vehicles[i].x +=  VEHICLE_SPEED; // Move smoothly left 
-                    if (vehicles[i].x >= WINDOW_WIDTH / 2 + 75) {
-                        vehicles[i].lane = 'C'; // Change the lane to either C3 or B3
-                        vehicles[i].sublane = 3;
-                    }
-                 }
-                }
-                // **C3 should turn left into A3 smoothly**
-                if (vehicles[i].sublane == 3 && vehicles[i].y >= WINDOW_HEIGHT / 2 - 75 && vehicles[i].y <= WINDOW_HEIGHT / 2 ) {
-                    // printf("Turning left: Vehicle %s from C3 to A3\n", vehicles[i].id);
-                    
-                    // Start moving right instead of continuing down
-                    vehicles[i].x += VEHICLE_SPEED; 
-
-                    // If vehicle has reached the middle, switch lanes
-                    if (vehicles[i].x >= WINDOW_WIDTH / 2) {
-                        vehicles[i].lane = 'A';
-                        vehicles[i].sublane = 1;
-                        vehicles[i].direction = 1; // Move right in A3
-                    }
-                }
-
-                break;
-
-            case 'D': 
-                if (vehicles[i].sublane == 2 && !trafficLights[3].green && vehicles[i].y <= (WINDOW_HEIGHT / 2 + STOP_DISTANCE) && vehicles[i].y > (WINDOW_HEIGHT / 2) + 150) {
-                    continue; // Stop if light is red and vehicle is close enough
-                }
-                vehicles[i].y -= VEHICLE_SPEED; // Move up
-
-                if (vehicles[i].sublane == 2 && vehicles[i].y <= WINDOW_HEIGHT / 2 ) {
-                    if(vehicles[i].choice == 0){
-                        vehicles[i].x += -VEHICLE_SPEED; // Move smoothly left  
-                        if (vehicles[i].x >= WINDOW_WIDTH / 2 + 75 || vehicles[i].x <= WINDOW_WIDTH / 2 - 75) {
-                            vehicles[i].lane = 'D'; // Change the lane either D1 or A1
-                            vehicles[i].sublane =  1;
-                        }
-                    }
-                    else{
-                        vehicles[i].x +=  VEHICLE_SPEED; // Move smoothly left 
-                        if (vehicles[i].x >= WINDOW_WIDTH / 2 + 75) {
-                            vehicles[i].lane = 'A'; // Change the lane to either D1 or A1
-                            vehicles[i].sublane =  1;
-                        }
-                    }
-                }
-
-                // **D3 should turn left into B3 smoothly**
-                if (vehicles[i].sublane == 3 && vehicles[i].y <= WINDOW_HEIGHT / 2 + 75) {
-                    // printf("Turning left: Vehicle %s from D3 to B3\n", vehicles[i].id);
-                    
-                    // Start moving left instead of continuing up
-                    vehicles[i].x -= VEHICLE_SPEED; 
-
-                    // If vehicle has reached the middle, switch lanes
-                    if (vehicles[i].x <= WINDOW_WIDTH / 2 - 75) {
-                        vehicles[i].lane = 'B';
-                        vehicles[i].sublane = 3;
-                        vehicles[i].direction = -1; // Move left in B3
-                    }
-                }
-                break;
-        }
+// Submit everything batched this frame in one draw call and start over
+void flushBatch(SDL_Renderer* renderer, QuadBatch* batch) {
+    if (batch->quadCount > 0) {
+        SDL_RenderGeometry(renderer, spriteAtlas, batch->vertices, batch->quadCount * 4,
+                           batch->indices, batch->quadCount * 6);
     }
-    SDL_UnlockMutex(vehicleMutex);
-    SDL_Delay(16); // Approximately 60 updates per second
+    batch->quadCount = 0;
 }
 
-void drawTrafficLights(SDL_Renderer* renderer) {
+void drawTrafficLights(QuadBatch* batch, const WorldSnapshot* world) {
     int center_x = WINDOW_WIDTH / 2;
     int center_y = WINDOW_HEIGHT / 2;
     
@@ -739,69 +96,56 @@ void drawTrafficLights(SDL_Renderer* renderer) {
     };
     
     for (int i = 0; i < 4; i++) {
-        if (trafficLights[i].green)
-            SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255); // Green
-        else
-            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255); // Red
-
-        SDL_RenderFillRect(renderer, &lights[i]);
+        SDL_Color color = world->green[i] ? (SDL_Color){ 0, 255, 0, 255 }  // Green
+                                          : (SDL_Color){ 255, 0, 0, 255 }; // Red
+        batchRect(batch, &lights[i], color);
     }
 }
 
 
 // Draw queue visualization
-void drawQueueVisualization(SDL_Renderer* renderer) {
-    // Display queue sizes as text
-    char queueText[4][20];
-    for (int i = 0; i < 4; i++) {
-        sprintf(queueText[i], "Lane %c: %d", 'A' + i, laneQueues[i].size);
-    }
-    
+void drawQueueVisualization(QuadBatch* batch, const WorldSnapshot* world) {
     // Draw small boxes to represent queue size
-    // For Lane A (left)
-    SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255);
-    SDL_Rect queueBoxA = { 50, 50, 120, 25 };
-    SDL_RenderFillRect(renderer, &queueBoxA);
-    
-    // For Lane B (right)
-    SDL_Rect queueBoxB = { WINDOW_WIDTH - 170, 50, 120, 25 };
-    SDL_RenderFillRect(renderer, &queueBoxB);
-    
-    // For Lane C (top)
-    SDL_Rect queueBoxC = { 50, 80, 120, 25 };
-    SDL_RenderFillRect(renderer, &queueBoxC);
-    
-    // For Lane D (bottom)
-    SDL_Rect queueBoxD = { WINDOW_WIDTH - 170, 80, 120, 25 };
-    SDL_RenderFillRect(renderer, &queueBoxD);
+    SDL_Color boxColor = { 200, 200, 200, 255 };
+    SDL_Rect queueBoxA = { 50, 50, 120, 25 };                 // For Lane A (left)
+    SDL_Rect queueBoxB = { WINDOW_WIDTH - 170, 50, 120, 25 }; // For Lane B (right)
+    SDL_Rect queueBoxC = { 50, 80, 120, 25 };                 // For Lane C (top)
+    SDL_Rect queueBoxD = { WINDOW_WIDTH - 170, 80, 120, 25 }; // For Lane D (bottom)
+    batchRect(batch, &queueBoxA, boxColor);
+    batchRect(batch, &queueBoxB, boxColor);
+    batchRect(batch, &queueBoxC, boxColor);
+    batchRect(batch, &queueBoxD, boxColor);
     
     // A line of differently colored boxes could represent vehicles in the queue
-    // Left side for Lane A
-    SDL_SetRenderDrawColor(renderer, 100, 100, 255, 255);
-    for (int i = 0; i < laneQueues[0].size && i < 10; i++) {
-        SDL_Rect vBox = { 55 + i * 12, 55, 10, 15 };
-        SDL_RenderFillRect(renderer, &vBox);
-    }
-    
-    // Right side for Lane B
-    SDL_SetRenderDrawColor(renderer, 100, 255, 100, 255);
-    for (int i = 0; i < laneQueues[1].size && i < 10; i++) {
-        SDL_Rect vBox = { WINDOW_WIDTH - 165 + i * 12, 55, 10, 15 };
-        SDL_RenderFillRect(renderer, &vBox);
-    }
-    
-    // Top for Lane C
-    SDL_SetRenderDrawColor(renderer, 255, 100, 100, 255);
-    for (int i = 0; i < laneQueues[2].size && i < 10; i++) {
-        SDL_Rect vBox = { 55 + i * 12, 85, 10, 15 };
-        SDL_RenderFillRect(renderer, &vBox);
+    const SDL_Color laneColors[4] = {
+        { 100, 100, 255, 255 }, // Left side for Lane A
+        { 100, 255, 100, 255 }, // Right side for Lane B
+        { 255, 100, 100, 255 }, // Top for Lane C
+        { 255, 255, 100, 255 }  // Bottom for Lane D
+    };
+    const int boxX[4] = { 55, WINDOW_WIDTH - 165, 55, WINDOW_WIDTH - 165 };
+    const int boxY[4] = { 55, 55, 85, 85 };
+    for (int lane = 0; lane < 4; lane++) {
+        for (int i = 0; i < world->queueSizes[lane] && i < 10; i++) {
+            SDL_Rect vBox = { boxX[lane] + i * 12, boxY[lane], 10, 15 };
+            batchRect(batch, &vBox, laneColors[lane]);
+        }
     }
-    
-    // Bottom for Lane D
-    SDL_SetRenderDrawColor(renderer, 255, 255, 100, 255);
-    for (int i = 0; i < laneQueues[3].size && i < 10; i++) {
-        SDL_Rect vBox = { WINDOW_WIDTH - 165 + i * 12, 85, 10, 15 };
-        SDL_RenderFillRect(renderer, &vBox);
+
+    // Beside each queue, the vehicles standing still in each of the lane's
+    // three sublanes, up to three per sublane. Read straight from the
+    // lock-free counters, so they may be a tick newer than the snapshot.
+    const int standingX[4] = { 175, WINDOW_WIDTH - 295, 175, WINDOW_WIDTH - 295 };
+    for (int lane = 0; lane < 4; lane++) {
+        SDL_Rect standingBox = { standingX[lane], boxY[lane] - 5, 120, 25 };
+        batchRect(batch, &standingBox, boxColor);
+        for (int sublane = 1; sublane <= 3; sublane++) {
+            int standing = laneWaiting('A' + lane, sublane);
+            for (int i = 0; i < standing && i < 3; i++) {
+                SDL_Rect vBox = { standingX[lane] + 5 + (sublane - 1) * 40 + i * 12, boxY[lane], 10, 15 };
+                batchRect(batch, &vBox, laneColors[lane]);
+            }
+        }
     }
 }
 
@@ -830,151 +174,123 @@ void drawRoundedRect(SDL_Renderer* renderer, SDL_Rect* rect, int radius) {
         }
     }
 }
-void drawVehicles(SDL_Renderer* renderer) {
-    SDL_LockMutex(vehicleMutex);
-    for (int i = 0; i < MAX_VEHICLES; i++) {
-        if (!vehicles[i].active) continue;
-
-        // Use the color attribute
-        SDL_SetRenderDrawColor(renderer, vehicles[i].color.r, vehicles[i].color.g, vehicles[i].color.b, vehicles[i].color.a);
-
-        SDL_Rect carBody;
-        SDL_Rect carWindow;
-        SDL_Rect carWheel1, carWheel2, carWheel3, carWheel4;
-
-        if (vehicles[i].lane == 'A' || vehicles[i].lane == 'B') { 
-            // Vehicles moving horizontally (left/right)
-            carBody = (SDL_Rect){
-                vehicles[i].x - VEHICLE_LENGTH / 2, 
-                vehicles[i].y - VEHICLE_SIZE / 2, 
-                VEHICLE_LENGTH,
-                VEHICLE_SIZE
-            };
-
-            carWindow = (SDL_Rect){
-                vehicles[i].x - VEHICLE_LENGTH / 4, 
-                vehicles[i].y - VEHICLE_SIZE / 4, 
-                VEHICLE_LENGTH / 2,
-                VEHICLE_SIZE / 2
-            };
-
-            carWheel1 = (SDL_Rect){
-                vehicles[i].x - VEHICLE_LENGTH / 2 + 5, 
-                vehicles[i].y - VEHICLE_SIZE / 2 - 5, 
-                10, 
-                10
-            };
-
-            carWheel2 = (SDL_Rect){
-                vehicles[i].x + VEHICLE_LENGTH / 2 - 15, 
-                vehicles[i].y - VEHICLE_SIZE / 2 - 5, 
-                10, 
-                10
-            };
-
-            carWheel3 = (SDL_Rect){
-                vehicles[i].x - VEHICLE_LENGTH / 2 + 5, 
-                vehicles[i].y + VEHICLE_SIZE / 2 - 5, 
-                10, 
-                10
-            };
-
-            carWheel4 = (SDL_Rect){
-                vehicles[i].x + VEHICLE_LENGTH / 2 - 15, 
-                vehicles[i].y + VEHICLE_SIZE / 2 - 5, 
-                10, 
-                10
-            };
-        } else {  
-            // Vehicles moving vertically (up/down)
-            carBody = (SDL_Rect){
-                vehicles[i].x - VEHICLE_SIZE / 2 + 5, 
-                vehicles[i].y - VEHICLE_LENGTH / 2, 
-                VEHICLE_SIZE,
-                VEHICLE_LENGTH
-            };
-
-            carWindow = (SDL_Rect){
-                vehicles[i].x - VEHICLE_SIZE / 4 + 5, 
-                vehicles[i].y - VEHICLE_LENGTH / 4, 
-                VEHICLE_SIZE / 2,
-                VEHICLE_LENGTH / 2
-            };
-
-            carWheel1 = (SDL_Rect){
-                vehicles[i].x - VEHICLE_SIZE / 2 , 
-                vehicles[i].y - VEHICLE_LENGTH / 2 + 5, 
-                10, 
-                10
-            };
-
-            carWheel2 = (SDL_Rect){
-                vehicles[i].x + VEHICLE_SIZE / 2 , 
-                vehicles[i].y - VEHICLE_LENGTH / 2 + 5, 
-                10, 
-                10
-            };
-
-            carWheel3 = (SDL_Rect){
-                vehicles[i].x - VEHICLE_SIZE / 2 , 
-                vehicles[i].y + VEHICLE_LENGTH / 2 - 15, 
-                10, 
-                10
-            };
-
-            carWheel4 = (SDL_Rect){
-                vehicles[i].x + VEHICLE_SIZE / 2 , 
-                vehicles[i].y + VEHICLE_LENGTH / 2 - 15, 
-                10, 
-                10
-            };
+// Shapes of a car centred on (x, y): body, window and four wheels
+static void carParts(bool horizontal, int x, int y, SDL_Rect* body, SDL_Rect* window, SDL_Rect wheels[4]) {
+    if (horizontal) {
+        // Vehicles moving horizontally (left/right)
+        *body = (SDL_Rect){ x - VEHICLE_LENGTH / 2, y - VEHICLE_SIZE / 2, VEHICLE_LENGTH, VEHICLE_SIZE };
+        *window = (SDL_Rect){ x - VEHICLE_LENGTH / 4, y - VEHICLE_SIZE / 4, VEHICLE_LENGTH / 2, VEHICLE_SIZE / 2 };
+        wheels[0] = (SDL_Rect){ x - VEHICLE_LENGTH / 2 + 5, y - VEHICLE_SIZE / 2 - 5, 10, 10 };
+        wheels[1] = (SDL_Rect){ x + VEHICLE_LENGTH / 2 - 15, y - VEHICLE_SIZE / 2 - 5, 10, 10 };
+        wheels[2] = (SDL_Rect){ x - VEHICLE_LENGTH / 2 + 5, y + VEHICLE_SIZE / 2 - 5, 10, 10 };
+        wheels[3] = (SDL_Rect){ x + VEHICLE_LENGTH / 2 - 15, y + VEHICLE_SIZE / 2 - 5, 10, 10 };
+    } else {
+        // Vehicles moving vertically (up/down)
+        *body = (SDL_Rect){ x - VEHICLE_SIZE / 2 + 5, y - VEHICLE_LENGTH / 2, VEHICLE_SIZE, VEHICLE_LENGTH };
+        *window = (SDL_Rect){ x - VEHICLE_SIZE / 4 + 5, y - VEHICLE_LENGTH / 4, VEHICLE_SIZE / 2, VEHICLE_LENGTH / 2 };
+        wheels[0] = (SDL_Rect){ x - VEHICLE_SIZE / 2, y - VEHICLE_LENGTH / 2 + 5, 10, 10 };
+        wheels[1] = (SDL_Rect){ x + VEHICLE_SIZE / 2, y - VEHICLE_LENGTH / 2 + 5, 10, 10 };
+        wheels[2] = (SDL_Rect){ x - VEHICLE_SIZE / 2, y + VEHICLE_LENGTH / 2 - 15, 10, 10 };
+        wheels[3] = (SDL_Rect){ x + VEHICLE_SIZE / 2, y + VEHICLE_LENGTH / 2 - 15, 10, 10 };
+    }
+}
+
+// Car sprites, drawn once at startup into one atlas texture. The body is
+// white so each vehicle's colour can be applied as its vertex colour; the
+// window and wheels keep their own colours, so they are a second, untinted
+// sprite laid over it.
+typedef struct {
+    SDL_Rect body;   // atlas rectangles
+    SDL_Rect trim;
+    SDL_Rect bounds; // sprite rectangle relative to the vehicle's position
+} CarSprite;
+
+static CarSprite carSprites[2]; // horizontal, vertical
+
+#define ATLAS_GAP 2 // keeps neighbouring sprites from bleeding into each other
+
+bool createSpriteAtlas(SDL_Renderer* renderer) {
+    // Lay the sprites out in a row, followed by the white patch
+    int x = 0;
+    atlasHeight = 0;
+    for (int orientation = 0; orientation < 2; orientation++) {
+        CarSprite* sprite = &carSprites[orientation];
+        SDL_Rect body, window, wheels[4];
+
+        // The sprite covers the body and the wheels sticking out of it
+        carParts(orientation == 0, 0, 0, &body, &window, wheels);
+        SDL_Rect bounds = body;
+        for (int i = 0; i < 4; i++) {
+            SDL_UnionRect(&bounds, &wheels[i], &bounds);
         }
+        sprite->bounds = bounds;
+        sprite->body = (SDL_Rect){ x, 0, bounds.w, bounds.h };
+        x += bounds.w + ATLAS_GAP;
+        sprite->trim = (SDL_Rect){ x, 0, bounds.w, bounds.h };
+        x += bounds.w + ATLAS_GAP;
+        if (bounds.h > atlasHeight) atlasHeight = bounds.h;
+    }
+    solidSource = (SDL_Rect){ x + 1, 1, 2, 2 }; // sampled well inside a 4x4 patch
+    atlasWidth = x + 4;
+
+    spriteAtlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                    SDL_TEXTUREACCESS_TARGET, atlasWidth, atlasHeight);
+    if (!spriteAtlas) {
+        return false;
+    }
+    SDL_SetTextureBlendMode(spriteAtlas, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderTarget(renderer, spriteAtlas);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
 
-        // Draw car body with rounded corners
-        drawRoundedRect(renderer, &carBody, 10);
+    for (int orientation = 0; orientation < 2; orientation++) {
+        const CarSprite* sprite = &carSprites[orientation];
+        SDL_Rect body, window, wheels[4];
 
-        // Draw car window with rounded corners
-        SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255); // Light gray for windows
-        drawRoundedRect(renderer, &carWindow, 5);
+        carParts(orientation == 0, sprite->body.x - sprite->bounds.x, -sprite->bounds.y, &body, &window, wheels);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        drawRoundedRect(renderer, &body, 10);
 
-        // Draw car wheels
+        carParts(orientation == 0, sprite->trim.x - sprite->bounds.x, -sprite->bounds.y, &body, &window, wheels);
+        SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255); // Light gray for windows
+        drawRoundedRect(renderer, &window, 5);
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); // Black for wheels
-        SDL_RenderFillRect(renderer, &carWheel1);
-        SDL_RenderFillRect(renderer, &carWheel2);
-        SDL_RenderFillRect(renderer, &carWheel3);
-        SDL_RenderFillRect(renderer, &carWheel4);
+        SDL_RenderFillRects(renderer, wheels, 4);
     }
-    SDL_UnlockMutex(vehicleMutex);
+    SDL_Rect solidPatch = { solidSource.x - 1, 0, 4, 4 };
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderFillRect(renderer, &solidPatch);
+
+    SDL_SetRenderTarget(renderer, NULL);
+    return true;
 }
 
-void* readAndParseFile(void* arg) {
-    printf("Reading vehicle data...\n");
-    while(1) {
-        FILE* file = fopen("vehicles.data", "r");
-        if (!file) {
-            perror("Error opening file");
-            sleep(1);
-            continue;
-        }
+void destroySpriteAtlas() {
+    if (spriteAtlas) SDL_DestroyTexture(spriteAtlas);
+    spriteAtlas = NULL;
+    free(frameBatch.vertices);
+    free(frameBatch.indices);
+    frameBatch = (QuadBatch){0};
+}
 
-        char line[20];
-        while (fgets(line, sizeof(line), file)) {
-            line[strcspn(line, "\n")] = 0;
-            char* vehicleNumber = strtok(line, ":");
-            char* lane = strtok(NULL, ":");
-            char* sublane = strtok(NULL, ":");
+void drawVehicles(QuadBatch* batch, const WorldSnapshot* world) {
+    const SDL_Color untinted = { 255, 255, 255, 255 };
+    for (int i = 0; i < world->vehicleCount; i++) {
+        const SnapshotVehicle* vehicle = &world->vehicles[i];
+        const CarSprite* sprite = &carSprites[(vehicle->lane == 'A' || vehicle->lane == 'B') ? 0 : 1];
+        SDL_Rect destination = {
+            (int)vehicle->x + sprite->bounds.x, (int)vehicle->y + sprite->bounds.y,
+            sprite->bounds.w, sprite->bounds.h
+        };
 
-            if (vehicleNumber && lane && sublane) {
-                printf("Read vehicle: %s, Lane: %s, Sublane: %s\n", vehicleNumber, lane, sublane);
-                spawnVehicle(vehicleNumber, lane[0], atoi(sublane));
-            }
-        }
-        fclose(file);
-        sleep(1);
+        // Tint the body with the vehicle's colour, then lay the trim over it
+        SDL_Color color = { vehicle->color.r, vehicle->color.g, vehicle->color.b, vehicle->color.a };
+        batchQuad(batch, &destination, &sprite->body, color);
+        batchQuad(batch, &destination, &sprite->trim, untinted);
     }
-    return NULL;
 }
 
+
 const SDL_Color WHITE = {255, 255, 255, 255};
 const SDL_Color GRAY = {30, 30, 30, 1};
 const SDL_Color YELLOW = {250, 250, 0, 255};
@@ -983,45 +299,133 @@ const SDL_Color YELLOW = {250, 250, 0, 255};
 const char* VEHICLE_FILE = "vehicles.data";
 
 
+// The simulation runs on its own thread and publishes a snapshot per tick;
+// the renderer draws between the two newest ones so motion stays smooth
+// whatever the two rates are. latestSnapshot() lends out one snapshot at a
+// time, so the renderer keeps copies of the two it interpolates between.
+static WorldSnapshot heldWorlds[2];
+static int newestHeld;
+static WorldSnapshot frameWorld; // interpolated world for the current frame
+
+static void copySnapshot(WorldSnapshot* to, const WorldSnapshot* from) {
+    if (to->vehicleCapacity < from->vehicleCount) {
+        SnapshotVehicle* grown = realloc(to->vehicles, from->vehicleCapacity * sizeof(SnapshotVehicle));
+        if (grown == NULL) {
+            perror("Failed to grow snapshot copy");
+            exit(1);
+        }
+        to->vehicles = grown;
+        to->vehicleCapacity = from->vehicleCapacity;
+    }
+    SnapshotVehicle* vehicles = to->vehicles;
+    int capacity = to->vehicleCapacity;
+    *to = *from;
+    to->vehicles = vehicles;
+    to->vehicleCapacity = capacity;
+    memcpy(to->vehicles, from->vehicles, from->vehicleCount * sizeof(SnapshotVehicle));
+}
+
+// World to draw this frame, at the simulated time the clock is being paced
+// to. The simulation thread ticks and then sleeps until the wall clock
+// catches up, so the newest snapshot is up to one tick ahead of that time
+// and the one before it is behind it. A vehicle that is in both is placed
+// between its two positions by where the render time falls between their
+// times. Lights and queues are taken from the newest.
+const WorldSnapshot* interpolateWorld(const WorldSnapshot* world) {
+    if (world->tick != heldWorlds[newestHeld].tick) {
+        newestHeld ^= 1;
+        copySnapshot(&heldWorlds[newestHeld], world);
+    }
+    const WorldSnapshot* newest = &heldWorlds[newestHeld];
+    const WorldSnapshot* older = &heldWorlds[newestHeld ^ 1];
+    double interval = newest->time - older->time;
+    if (simClock.timeScale <= 0 || older->tick == 0 || interval <= 0) {
+        return newest; // unlimited speed or nothing to blend with
+    }
+    double renderTime = simClockPacedTime(&simClock);
+    float t = (renderTime - older->time) / interval;
+    if (t >= 1.0f) {
+        return newest; // the next snapshot is late
+    }
+    if (t < 0.0f) {
+        t = 0.0f;
+    }
+
+    copySnapshot(&frameWorld, newest);
+    // Both lists are in slot order, so one pass pairs them up
+    int j = 0;
+    for (int i = 0; i < frameWorld.vehicleCount; i++) {
+        SnapshotVehicle* vehicle = &frameWorld.vehicles[i];
+        while (j < older->vehicleCount && older->vehicles[j].slot < vehicle->slot) j++;
+        if (j == older->vehicleCount) break;
+        const SnapshotVehicle* before = &older->vehicles[j];
+        if (before->slot != vehicle->slot || before->serial != vehicle->serial) {
+            continue; // spawned since, drawn where it is
+        }
+        vehicle->x = before->x + (vehicle->x - before->x) * t;
+        vehicle->y = before->y + (vehicle->y - before->y) * t;
+    }
+    return &frameWorld;
+}
+
+static atomic_bool simulationRunning = true;
+
+// Fixed-rate simulation thread: one tick of SIM_TICK_SECONDS at a time,
+// paced against the wall clock by the simulated clock
+void* runSimulation(void* arg) {
+    while (atomic_load(&simulationRunning)) {
+        simulationTick();
+        simClockPace(&simClock);
+    }
+    return NULL;
+}
+
+
 // Function declarations
 bool initializeSDL(SDL_Window **window, SDL_Renderer **renderer);
 void drawRoadsAndLane(SDL_Renderer *renderer, TTF_Font *font);
+bool drawBackground(SDL_Renderer *renderer, TTF_Font *font);
+void destroyBackgroundLayer();
 void displayText(SDL_Renderer *renderer, TTF_Font *font, char *text, int x, int y);
+void clearTextCache();
 void refreshLight(SDL_Renderer *renderer, SharedData* sharedData);
-void* readAndParseFile(void* arg);
-void* mainLoop(void* arg);
 
 
 void printMessageHelper(const char* message, int count) {
     for (int i = 0; i < count; i++) printf("%s\n", message);
 }
 int main(int argc, char *argv[]) {
-    pthread_t vehicleThread, trafficThread, fileThread;
+    pthread_t vehicleThread, trafficThread, fileThread, simulationThread;
     SDL_Window* window = NULL;
     SDL_Renderer* renderer = NULL;
     TTF_Font* font = NULL;
+    double timeScale = 1.0; // 1x real time; 0 runs the simulation as fast as possible
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc) {
+            timeScale = atof(argv[++i]);
+        }
+    }
     
     // Initialize SDL and create window and renderer
     if (!initializeSDL(&window, &renderer)) {
         return -1;
     }
     
-    // Load font
-    font = TTF_OpenFont(MAIN_FONT, 24);
-    if (!font) {
-        SDL_Log("Failed to load font: %s", TTF_GetError());
+    if (!createSpriteAtlas(renderer)) {
+        SDL_Log("Failed to create sprite atlas: %s", SDL_GetError());
+        destroySpriteAtlas();
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         TTF_Quit();
         SDL_Quit();
         return -1;
     }
-    
-    // Initialize vehicle system and mutex
-    vehicleMutex = SDL_CreateMutex();
-    if (!vehicleMutex) {
-        SDL_Log("Failed to create mutex: %s", SDL_GetError());
-        TTF_CloseFont(font);
+
+    // Load font
+    font = TTF_OpenFont(MAIN_FONT, 24);
+    if (!font) {
+        SDL_Log("Failed to load font: %s", TTF_GetError());
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         TTF_Quit();
@@ -1029,13 +433,15 @@ int main(int argc, char *argv[]) {
         return -1;
     }
     
-    initVehicles();
+    // Initialize vehicle system
+    seedSimulation((uint64_t)time(NULL));
+    initVehicles(INITIAL_VEHICLE_CAPACITY);
     initTrafficLights();
+    simClockInit(&simClock, timeScale);
     
     // Create threads
     if (pthread_create(&vehicleThread, NULL, generateVehicles, NULL) != 0) {
         SDL_Log("Failed to create vehicle thread");
-        SDL_DestroyMutex(vehicleMutex);
         TTF_CloseFont(font);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
@@ -1048,7 +454,6 @@ int main(int argc, char *argv[]) {
         SDL_Log("Failed to create traffic light thread");
         // Cancel the vehicle thread
         pthread_cancel(vehicleThread);
-        SDL_DestroyMutex(vehicleMutex);
         TTF_CloseFont(font);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
@@ -1062,7 +467,6 @@ int main(int argc, char *argv[]) {
         // Cancel the other threads
         pthread_cancel(vehicleThread);
         pthread_cancel(trafficThread);
-        SDL_DestroyMutex(vehicleMutex);
         TTF_CloseFont(font);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
@@ -1071,9 +475,26 @@ int main(int argc, char *argv[]) {
         return -1;
     }
     
-    // Main application loop
+    if (pthread_create(&simulationThread, NULL, runSimulation, NULL) != 0) {
+        SDL_Log("Failed to create simulation thread");
+        // Cancel the other threads
+        pthread_cancel(vehicleThread);
+        pthread_cancel(trafficThread);
+        pthread_cancel(fileThread);
+        TTF_CloseFont(font);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        TTF_Quit();
+        SDL_Quit();
+        return -1;
+    }
+    
+    // Main application loop: draws at display rate, the simulation runs on its own
     bool running = true;
-    Uint32 lastFrameTime = SDL_GetTicks();
+    Uint32 targetFrameTime = 16; // 60 FPS when presenting is not synced to the display
+    SDL_RendererInfo rendererInfo;
+    bool vsync = SDL_GetRendererInfo(renderer, &rendererInfo) == 0 &&
+                 (rendererInfo.flags & SDL_RENDERER_PRESENTVSYNC);
     
     while (running) {
         // Handle SDL events
@@ -1082,46 +503,57 @@ int main(int argc, char *argv[]) {
             if (event.type == SDL_QUIT) {
                 running = false;
             }
+            // Render targets can lose their contents, e.g. on Direct3D
+            if (event.type == SDL_RENDER_TARGETS_RESET || event.type == SDL_RENDER_DEVICE_RESET) {
+                clearTextCache();
+                destroyBackgroundLayer();
+                destroySpriteAtlas();
+                if (!createSpriteAtlas(renderer)) {
+                    SDL_Log("Failed to recreate sprite atlas: %s", SDL_GetError());
+                    running = false;
+                }
+            }
             // Add any other event handling here as needed
         }
         
-        // Calculate delta time
         Uint32 currentTime = SDL_GetTicks();
-        float deltaTime = (currentTime - lastFrameTime) / 1000.0f;
-        lastFrameTime = currentTime;
-        
-        // Update simulation
-        updateVehicles();
-        updateTrafficQueues();
         
-        // Render frame
+        // Render frame from the latest snapshots; the simulation lock is not held
+        const WorldSnapshot* world = interpolateWorld(latestSnapshot());
         SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
         SDL_RenderClear(renderer);
         
-        drawRoadsAndLane(renderer, font);
-        drawTrafficLights(renderer);
-        drawVehicles(renderer);
-        drawQueueVisualization(renderer);
+        if (!drawBackground(renderer, font)) {
+            SDL_Log("Failed to create background layer: %s", SDL_GetError());
+            running = false;
+        }
+        drawTrafficLights(&frameBatch, world);
+        drawVehicles(&frameBatch, world);
+        drawQueueVisualization(&frameBatch, world);
+        flushBatch(renderer, &frameBatch);
         
         SDL_RenderPresent(renderer);
         
-        // Cap the frame rate
-        Uint32 frameTime = SDL_GetTicks() - currentTime;
-        Uint32 targetFrameTime = 16; // 60 FPS
+        // Cap the frame rate; with vsync presenting already waits
         Uint32 frameEndTime = SDL_GetTicks();
-        if (frameEndTime - currentTime < targetFrameTime) {
+        if (!vsync && frameEndTime - currentTime < targetFrameTime) {
             SDL_Delay(targetFrameTime - (frameEndTime - currentTime));
         }
         
     }
     
-    // Cleanup and shutdown
+    // Cleanup and shutdown; the simulation finishes its tick first, as the
+    // other threads may be needed to complete it
+    atomic_store(&simulationRunning, false);
+    pthread_join(simulationThread, NULL);
     pthread_cancel(vehicleThread);
     pthread_cancel(trafficThread);
     pthread_cancel(fileThread);
     
-    SDL_DestroyMutex(vehicleMutex);
+    clearTextCache();
+    destroyBackgroundLayer();
     TTF_CloseFont(font);
+    destroySpriteAtlas();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     TTF_Quit();
@@ -1130,32 +562,6 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
-// Modified main loop
-void* mainLoop(void* arg) {
-    SDL_Renderer* renderer = (SDL_Renderer*)arg;
-    Uint32 lastFrame = SDL_GetTicks();
-
-    while (1) {
-        Uint32 currentFrame = SDL_GetTicks();
-        float deltaTime = (currentFrame - lastFrame) / 1000.0f;
-        lastFrame = currentFrame;
-
-        updateVehicles();  
-
-        SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255); // Set background color to dark gray
-        SDL_RenderClear(renderer);
-        
-        drawRoadsAndLane(renderer, NULL);
-        drawTrafficLights(renderer);
-        drawVehicles(renderer);
-
-        SDL_RenderPresent(renderer);
-
-        SDL_Delay(16); // Maintain ~60 FPS
-    }
-    return NULL;
-}
-
 bool initializeSDL(SDL_Window **window, SDL_Renderer **renderer) {
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
@@ -1178,7 +584,7 @@ bool initializeSDL(SDL_Window **window, SDL_Renderer **renderer) {
         return false;
     }
 
-    *renderer = SDL_CreateRenderer(*window, -1, SDL_RENDERER_ACCELERATED);
+    *renderer = SDL_CreateRenderer(*window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE | SDL_RENDERER_PRESENTVSYNC);
     // if you have high resolution monitor 2K or 4K then scale
     SDL_RenderSetScale(*renderer, SCALE, SCALE);
 
@@ -1294,20 +700,136 @@ void drawRoadsAndLane(SDL_Renderer *renderer, TTF_Font *font) {
 }
 
 
+// Roads, lane markings and labels never change, so they are drawn once into
+// a target texture and copied to the screen every frame. The layer remembers
+// what it was built for and is rebuilt when the output size or font changes.
+static SDL_Texture* backgroundLayer;
+static int backgroundOutputW, backgroundOutputH;
+static TTF_Font* backgroundFont;
+
+void destroyBackgroundLayer() {
+    if (backgroundLayer) SDL_DestroyTexture(backgroundLayer);
+    backgroundLayer = NULL;
+}
+
+static bool buildBackgroundLayer(SDL_Renderer *renderer, TTF_Font *font) {
+    backgroundLayer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                        SDL_TEXTUREACCESS_TARGET, WINDOW_WIDTH, WINDOW_HEIGHT);
+    if (!backgroundLayer) {
+        return false;
+    }
+    // Copied as is; the lane markings are drawn with an alpha of 1
+    SDL_SetTextureBlendMode(backgroundLayer, SDL_BLENDMODE_NONE);
+    SDL_SetRenderTarget(renderer, backgroundLayer);
+    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
+    SDL_RenderClear(renderer);
+    drawRoadsAndLane(renderer, font);
+    SDL_SetRenderTarget(renderer, NULL);
+    return true;
+}
+
+bool drawBackground(SDL_Renderer *renderer, TTF_Font *font) {
+    int outputW, outputH;
+    SDL_GetRendererOutputSize(renderer, &outputW, &outputH);
+    if (backgroundLayer && (outputW != backgroundOutputW || outputH != backgroundOutputH || font != backgroundFont)) {
+        destroyBackgroundLayer();
+    }
+    if (!backgroundLayer) {
+        backgroundOutputW = outputW;
+        backgroundOutputH = outputH;
+        backgroundFont = font;
+        if (!buildBackgroundLayer(renderer, font)) {
+            return false;
+        }
+    }
+    SDL_RenderCopy(renderer, backgroundLayer, NULL, NULL);
+    return true;
+}
+
+
+// Rendered text kept as textures, so labels that don't change are not
+// rasterized and uploaded again every frame. Small enough to search
+// linearly; when full, the least recently used entry is replaced.
+#define TEXT_CACHE_SIZE 32
+#define TEXT_CACHE_MAX_LENGTH 64 // longer strings are rendered without caching
+
+typedef struct {
+    char text[TEXT_CACHE_MAX_LENGTH];
+    TTF_Font* font;
+    SDL_Color color;
+    SDL_Texture* texture; // NULL if the slot is free
+    int w, h;
+    unsigned long lastUsed;
+} TextCacheEntry;
+
+static TextCacheEntry textCache[TEXT_CACHE_SIZE];
+static unsigned long textCacheClock;
+
+void clearTextCache() {
+    for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+        if (textCache[i].texture) SDL_DestroyTexture(textCache[i].texture);
+        textCache[i].texture = NULL;
+    }
+}
+
+static SDL_Texture* renderTextTexture(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Color color) {
+    SDL_Surface *textSurface = TTF_RenderText_Solid(font, text, color);
+    if (!textSurface) {
+        return NULL;
+    }
+    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, textSurface);
+    SDL_FreeSurface(textSurface);
+    return texture;
+}
+
+// Texture for a string, from the cache when it was drawn before
+static TextCacheEntry* cachedText(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Color color) {
+    TextCacheEntry* slot = &textCache[0];
+    for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+        TextCacheEntry* entry = &textCache[i];
+        if (entry->texture && entry->font == font && strcmp(entry->text, text) == 0 &&
+            memcmp(&entry->color, &color, sizeof(color)) == 0) {
+            entry->lastUsed = ++textCacheClock;
+            return entry;
+        }
+        // Remember a free slot, or else the least recently used one
+        if (slot->texture && (!entry->texture || entry->lastUsed < slot->lastUsed)) {
+            slot = entry;
+        }
+    }
+
+    SDL_Texture* texture = renderTextTexture(renderer, font, text, color);
+    if (!texture) {
+        return NULL;
+    }
+    if (slot->texture) SDL_DestroyTexture(slot->texture);
+    snprintf(slot->text, sizeof(slot->text), "%s", text);
+    slot->font = font;
+    slot->color = color;
+    slot->texture = texture;
+    SDL_QueryTexture(texture, NULL, NULL, &slot->w, &slot->h);
+    slot->lastUsed = ++textCacheClock;
+    return slot;
+}
+
 void displayText(SDL_Renderer *renderer, TTF_Font *font, char *text, int x, int y){
     // display necessary text
     SDL_Color textColor = {255, 255, 255, 255}; // white color
-    SDL_Surface *textSurface = TTF_RenderText_Solid(font, text, textColor);
-    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, textSurface);
-    SDL_FreeSurface(textSurface);
+    if (strlen(text) < TEXT_CACHE_MAX_LENGTH) {
+        TextCacheEntry* entry = cachedText(renderer, font, text, textColor);
+        if (entry) {
+            SDL_Rect textRect = { x, y, entry->w, entry->h };
+            SDL_RenderCopy(renderer, entry->texture, NULL, &textRect);
+        }
+        return;
+    }
+
+    SDL_Texture *texture = renderTextTexture(renderer, font, text, textColor);
+    if (!texture) {
+        return;
+    }
     SDL_Rect textRect = {x,y,0,0 };
     SDL_QueryTexture(texture, NULL, NULL, &textRect.w, &textRect.h);
-    // SDL_Log("DIM of SDL_Rect %d %d %d %d", textRect.x, textRect.y, textRect.h, textRect.w);
-    // SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    // SDL_Log("TTF_Error: %s\n", TTF_GetError());
     SDL_RenderCopy(renderer, texture, NULL, &textRect);
-    // SDL_Log("TTF_Error: %s\n", TTF_GetError());
     SDL_DestroyTexture(texture);
 }
-
-